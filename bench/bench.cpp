@@ -0,0 +1,452 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "blockcache.h"
+#include "chip8.h"
+#include "jit.h"
+
+// Microbenchmarks
+// measures what individual opcode functions cost, what Cycle adds on top
+// of them to fetch and dispatch, what drawing costs, and the instructions
+// per second of whole programs on each engine
+// the results are printed as JSON, one object per benchmark, so that runs
+// can be compared between builds
+
+// BUNDLED ROMS
+// small programs that loop forever and never wait for a key
+// each one stresses a different part of the interpreter
+struct BenchROM
+{
+    char const* name;
+    std::vector<uint8_t> bytes;
+};
+
+static std::vector<BenchROM> const roms =
+{
+    // register arithmetic, the opcodes the Jit compiles natively
+    { "alu", {
+        0x60, 0x01,     // 200: LD V0, 1
+        0x61, 0x02,     // 202: LD V1, 2
+        0x80, 0x14,     // 204: ADD V0, V1
+        0x81, 0x05,     // 206: SUB V1, V0
+        0x82, 0x03,     // 208: XOR V2, V0
+        0x73, 0x01,     // 20A: ADD V3, 1
+        0x83, 0x36,     // 20C: SHR V3
+        0x84, 0x2E,     // 20E: SHL V4
+        0x12, 0x04,     // 210: JP 204
+    } },
+    // a sprite drawn across the screen, over and over
+    { "draw", {
+        0x60, 0x00,     // 200: LD V0, 0
+        0x61, 0x00,     // 202: LD V1, 0
+        0xA2, 0x10,     // 204: LD I, 210
+        0xD0, 0x15,     // 206: DRW V0, V1, 5
+        0x70, 0x01,     // 208: ADD V0, 1
+        0x71, 0x03,     // 20A: ADD V1, 3
+        0x12, 0x04,     // 20C: JP 204
+        0x00, 0x00,     // 20E: padding
+        0xF0, 0x90, 0xF0, 0x90, 0xF0,   // 210: sprite
+    } },
+    // BCD, stores and loads, which also make the code caches check for writes
+    { "memory", {
+        0xA3, 0x00,     // 200: LD I, 300
+        0x6A, 0x7B,     // 202: LD VA, 7B
+        0xFA, 0x33,     // 204: LD B, VA
+        0xF2, 0x55,     // 206: LD [I], V2
+        0xF2, 0x65,     // 208: LD V2, [I]
+        0x7A, 0x01,     // 20A: ADD VA, 1
+        0x12, 0x04,     // 20C: JP 204
+    } },
+    // a subroutine call and return
+    { "calls", {
+        0x22, 0x06,     // 200: CALL 206
+        0x70, 0x01,     // 202: ADD V0, 1
+        0x12, 0x00,     // 204: JP 200
+        0x00, 0xEE,     // 206: RET
+    } },
+    // conditional skips, taken and not taken
+    { "skips", {
+        0x70, 0x01,     // 200: ADD V0, 1
+        0x30, 0x80,     // 202: SE V0, 80
+        0x12, 0x08,     // 204: JP 208
+        0x60, 0x00,     // 206: LD V0, 0
+        0x50, 0x10,     // 208: SE V0, V1
+        0x71, 0x01,     // 20A: ADD V1, 1
+        0x90, 0x10,     // 20C: SNE V0, V1
+        0x61, 0x00,     // 20E: LD V1, 0
+        0x12, 0x00,     // 210: JP 200
+    } },
+    // random numbers, timers and key checks
+    { "io", {
+        0xC0, 0xFF,     // 200: RND V0, FF
+        0xF0, 0x15,     // 202: LD DT, V0
+        0xF1, 0x07,     // 204: LD V1, DT
+        0xE0, 0x9E,     // 206: SKP V0
+        0xE1, 0xA1,     // 208: SKNP V1
+        0x12, 0x00,     // 20A: JP 200
+    } },
+};
+
+// the options every benchmark is run with
+struct BenchOptions
+{
+    // keep doubling the iterations until a run takes at least this long
+    double minSeconds{ 0.2 };
+};
+
+// what one benchmark measured
+struct BenchResult
+{
+    std::string group;
+    std::string name;
+    unsigned long operations{};
+    double seconds{};
+};
+
+// run body(iterations) with more and more iterations until it takes long enough
+// body returns the number of operations it did, which may differ
+// from the number of iterations
+static BenchResult Measure(std::string group, std::string name,
+    BenchOptions const& options, std::function<unsigned long(unsigned long)> body)
+{
+    BenchResult result{ group, name };
+
+    for (unsigned long iterations = 1024; ; iterations *= 2)
+    {
+        auto start = std::chrono::steady_clock::now();
+        result.operations = body(iterations);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (result.seconds >= options.minSeconds)
+        {
+            return result;
+        }
+    }
+}
+
+// a machine in a known state to benchmark opcodes on
+static Chip8 BenchMachine()
+{
+    Chip8 chip8;
+    chip8.Seed(0);
+
+    for (unsigned int i = 0; i < 16; ++i)
+    {
+        chip8.registers[i] = i * 17;
+    }
+
+    // somewhere that Fx33, Fx55 and Fx65 can write without hitting the font
+    chip8.index = 0x300;
+
+    return chip8;
+}
+
+// load one of the bundled ROMs into a new machine
+static Chip8 LoadBundled(BenchROM const& rom)
+{
+    Chip8 chip8;
+    chip8.Seed(0);
+    chip8.loadROM(rom.bytes.data(), rom.bytes.size());
+
+    return chip8;
+}
+
+// the cost of each opcode function on its own, called directly
+static void BenchOpcodes(BenchOptions const& options, std::vector<BenchResult>& results)
+{
+    struct Opcode
+    {
+        char const* name;
+        uint16_t opcode;
+    };
+
+    // one of each opcode, with operands that keep it from doing anything
+    // that would need resetting between calls
+    // 2nnn and 00EE are measured as a pair, so that the stack never overflows
+    // Dxyn has its own benchmarks below
+    static Opcode const opcodes[] =
+    {
+        { "00E0", 0x00E0 }, { "1nnn", 0x1200 }, { "3xkk", 0x3312 },
+        { "4xkk", 0x4312 }, { "5xy0", 0x5120 }, { "6xkk", 0x6A12 },
+        { "7xkk", 0x7A12 }, { "8xy0", 0x8120 }, { "8xy1", 0x8121 },
+        { "8xy2", 0x8122 }, { "8xy3", 0x8123 }, { "8xy4", 0x8124 },
+        { "8xy5", 0x8125 }, { "8xy6", 0x8126 }, { "8xy7", 0x8127 },
+        { "8xyE", 0x812E }, { "9xy0", 0x9120 }, { "Annn", 0xA300 },
+        { "Bnnn", 0xB200 }, { "Cxkk", 0xC3FF }, { "Ex9E", 0xE39E },
+        { "ExA1", 0xE3A1 }, { "Fx07", 0xF307 }, { "Fx0A", 0xF30A },
+        { "Fx15", 0xF315 }, { "Fx18", 0xF318 }, { "Fx1E", 0xF31E },
+        { "Fx29", 0xF329 }, { "Fx33", 0xF333 }, { "Fx55", 0xFF55 },
+        { "Fx65", 0xFF65 },
+    };
+
+    for (Opcode const& op : opcodes)
+    {
+        Chip8::Handler handler = Chip8::Decode(op.opcode);
+
+        results.push_back(Measure("opcode", op.name, options, [&](unsigned long iterations)
+        {
+            Chip8 chip8 = BenchMachine();
+            chip8.opcode = op.opcode;
+
+            for (unsigned long i = 0; i < iterations; ++i)
+            {
+                // Fx1E and Fx29 move I, so put it back
+                // the pc can go anywhere, since nothing is fetched from it
+                chip8.index = 0x300;
+                (chip8.*handler)();
+            }
+
+            return iterations;
+        }));
+    }
+
+    results.push_back(Measure("opcode", "2nnn+00EE", options, [](unsigned long iterations)
+    {
+        Chip8 chip8 = BenchMachine();
+
+        for (unsigned long i = 0; i < iterations; ++i)
+        {
+            chip8.opcode = 0x2300;
+            chip8.OP_2nnn();
+            chip8.opcode = 0x00EE;
+            chip8.OP_00EE();
+        }
+
+        return iterations * 2;
+    }));
+}
+
+// what Cycle adds on top of the opcode functions
+// a ROM of nothing but 6xkk runs through Cycle, and the same opcode
+// is called directly, the difference being fetching and decoding
+static void BenchDispatch(BenchOptions const& options, std::vector<BenchResult>& results)
+{
+    // 6xkk with every register, then a jump back to the start
+    std::vector<uint8_t> rom;
+
+    for (unsigned int x = 0; x < 16; ++x)
+    {
+        rom.push_back(0x60 | x);
+        rom.push_back(x);
+    }
+
+    rom.push_back(0x12);
+    rom.push_back(0x00);
+
+    results.push_back(Measure("dispatch", "Cycle", options, [&](unsigned long iterations)
+    {
+        Chip8 chip8;
+        chip8.loadROM(rom.data(), rom.size());
+
+        for (unsigned long i = 0; i < iterations; ++i)
+        {
+            chip8.Cycle();
+        }
+
+        return iterations;
+    }));
+
+    results.push_back(Measure("dispatch", "direct", options, [](unsigned long iterations)
+    {
+        Chip8 chip8 = BenchMachine();
+
+        for (unsigned long i = 0; i < iterations; ++i)
+        {
+            chip8.opcode = 0x6000 | ((i & 0xF) << 8u) | (i & 0xF);
+            chip8.OP_6xkk();
+        }
+
+        return iterations;
+    }));
+
+    results.push_back(Measure("dispatch", "Decode", options, [](unsigned long iterations)
+    {
+        // count the invalid opcodes, so that the lookups can't be thrown away
+        static volatile unsigned long invalid;
+        unsigned long count = 0;
+
+        for (unsigned long i = 0; i < iterations; ++i)
+        {
+            count += Chip8::Decode(i & 0xFFFF) == &Chip8::OP_NULL;
+        }
+
+        invalid = count;
+
+        return iterations;
+    }));
+}
+
+// the cost of drawing one 15 row sprite from the font
+static void BenchDraw(BenchOptions const& options, std::vector<BenchResult>& results)
+{
+    struct Position
+    {
+        char const* name;
+        uint8_t x;
+        uint8_t y;
+    };
+
+    // aligned sprites land on a byte boundary, unaligned ones straddle two
+    // clipped ones hang off the right and bottom edges
+    static Position const positions[] =
+    {
+        { "Dxyn-aligned", 8, 0 },
+        { "Dxyn-unaligned", 3, 0 },
+        { "Dxyn-clipped", 60, 28 },
+    };
+
+    for (Position const& position : positions)
+    {
+        results.push_back(Measure("draw", position.name, options, [&](unsigned long iterations)
+        {
+            Chip8 chip8 = BenchMachine();
+            chip8.index = 0x50;
+            chip8.opcode = 0xD01F;
+
+            for (unsigned long i = 0; i < iterations; ++i)
+            {
+                chip8.registers[0] = position.x;
+                chip8.registers[1] = position.y;
+                chip8.OP_Dxyn();
+            }
+
+            return iterations;
+        }));
+    }
+}
+
+// instructions per second of every bundled ROM on every engine
+static void BenchROMs(BenchOptions const& options, std::vector<BenchResult>& results)
+{
+    for (BenchROM const& rom : roms)
+    {
+        results.push_back(Measure("rom-interp", rom.name, options, [&](unsigned long iterations)
+        {
+            Chip8 chip8 = LoadBundled(rom);
+
+            for (unsigned long i = 0; i < iterations; ++i)
+            {
+                chip8.Cycle();
+            }
+
+            return iterations;
+        }));
+
+        results.push_back(Measure("rom-cache", rom.name, options, [&](unsigned long iterations)
+        {
+            Chip8 chip8 = LoadBundled(rom);
+            BlockCache cache;
+
+            return cache.Run(chip8, iterations);
+        }));
+
+        results.push_back(Measure("rom-cache-unfused", rom.name, options, [&](unsigned long iterations)
+        {
+            Chip8 chip8 = LoadBundled(rom);
+            BlockCache cache;
+            cache.fuse = false;
+
+            return cache.Run(chip8, iterations);
+        }));
+
+        results.push_back(Measure("rom-jit", rom.name, options, [&](unsigned long iterations)
+        {
+            Chip8 chip8 = LoadBundled(rom);
+            Jit jit;
+
+            return jit.Run(chip8, iterations);
+        }));
+    }
+}
+
+static void Usage(char const* name)
+{
+    std::cerr << "Usage: " << name << " [--min-time SECONDS] [--group opcode|dispatch|draw|rom]\n";
+    std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    std::string group;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--min-time" && i + 1 < argc)
+        {
+            options.minSeconds = std::stod(argv[++i]);
+        }
+        else if (arg == "--group" && i + 1 < argc)
+        {
+            group = argv[++i];
+        }
+        else
+        {
+            Usage(argv[0]);
+        }
+    }
+
+    std::vector<BenchResult> results;
+
+    if (group.empty() || group == "opcode")
+    {
+        BenchOpcodes(options, results);
+    }
+
+    if (group.empty() || group == "dispatch")
+    {
+        BenchDispatch(options, results);
+    }
+
+    if (group.empty() || group == "draw")
+    {
+        BenchDraw(options, results);
+    }
+
+    if (group.empty() || group == "rom")
+    {
+        BenchROMs(options, results);
+    }
+
+    // the build configuration, so results from different builds
+    // aren't mixed up
+#if defined(CHIP8_DISPATCH_FLAT)
+    char const* dispatch = "flat";
+#elif defined(CHIP8_DISPATCH_SWITCH)
+    char const* dispatch = "switch";
+#else
+    char const* dispatch = "tables";
+#endif
+
+#ifdef CHIP8_SHARED_MEMORY
+    char const* memory = "shared";
+#else
+    char const* memory = "flat";
+#endif
+
+    std::printf("{\n  \"dispatch\": \"%s\",\n  \"memory\": \"%s\",\n  \"jit\": %s,\n  \"benchmarks\": [\n",
+        dispatch, memory, Jit().Native() ? "true" : "false");
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        BenchResult const& result = results[i];
+        double nanoseconds = result.seconds * 1e9 / result.operations;
+
+        std::printf("    { \"group\": \"%s\", \"name\": \"%s\", \"operations\": %lu, "
+            "\"seconds\": %.6f, \"ns_per_op\": %.3f, \"ops_per_second\": %.0f }%s\n",
+            result.group.c_str(), result.name.c_str(), result.operations,
+            result.seconds, nanoseconds, result.operations / result.seconds,
+            i + 1 < results.size() ? "," : "");
+    }
+
+    std::printf("  ]\n}\n");
+
+    return 0;
+}
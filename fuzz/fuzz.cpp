@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "blockcache.h"
+#include "chip8.h"
+#include "jit.h"
+#include "profile.h"
+#include "romanalysis.h"
+#include "scheduler.h"
+
+// Differential fuzzing harness
+// every input is run on three machines for up to MAX_CYCLES instructions:
+// the interpreter one Cycle at a time without skipping idle loops, a
+// prewarmed BlockCache, and the Jit, each skipping idle loops as usual.
+// They should always end up with the same hash, and the harness aborts
+// when they don't, so the fuzzer keeps the input
+// an input is a byte with the number of key events in its low 5 bits,
+// then that many events of a 16 bit little endian cycle and a key byte
+// like the input log's (the key in the low 4 bits, 0x10 if pressed),
+// and then the ROM, loaded with the in memory Chip8::loadROM
+// the addresses the interpreter runs and the jumps between them are
+// recorded as coverage of the guest program, so the fuzzer is steered
+// towards ROMs that take new paths, not just new paths through the host
+//
+// It builds two ways:
+//  - with libFuzzer, which supplies main and calls LLVMFuzzerTestOneInput,
+//    and picks up the guest coverage as extra counters
+//  - with CHIP8_FUZZ_MAIN, a main of its own that runs every file named
+//    on the command line and prints the guest coverage of all of them,
+//    or with no files runs stdin. Built with afl-clang-fast++ it loops in
+//    AFL's persistent mode
+
+// the most instructions an input runs
+static const unsigned long MAX_CYCLES = 20000;
+// the number of instructions between timer ticks, as in bin/batch
+static const unsigned int INSTRUCTIONS_PER_FRAME = 10;
+// the most key events an input can have
+static const unsigned int MAX_EVENTS = 31;
+
+// one counter for every pair of an address and the one before it, hashed
+// the way AFL hashes edges, and one for every address on its own
+static const unsigned int EDGES = 1 << 13;
+
+#if defined(__linux__) && !defined(CHIP8_FUZZ_MAIN)
+// libFuzzer treats everything in this section as coverage counters
+__attribute__((section("__libfuzzer_extra_counters")))
+#endif
+static uint8_t guestEdges[EDGES + Memory::SIZE];
+
+#ifdef CHIP8_FUZZ_MAIN
+// the instructions run, for the report at the end
+static bool opcodes[0x10000];
+#endif
+
+// Count a hit, sticking at the top rather than wrapping back to zero
+static void Hit(uint8_t& counter)
+{
+    counter += counter != UINT8_MAX;
+}
+
+struct Event
+{
+    uint16_t cycle;
+    uint8_t key;
+};
+
+// Run chip8 for MAX_CYCLES instructions, applying the key events at their
+// cycles like bin/replay does
+static void Run(Chip8& chip8, Scheduler& scheduler, std::vector<Event> const& events)
+{
+    size_t next = 0;
+
+    while (scheduler.cycles < MAX_CYCLES)
+    {
+        uint64_t frameEnd = scheduler.cycles + scheduler.FrameLength();
+        uint64_t end = std::min<uint64_t>(frameEnd, MAX_CYCLES);
+
+        while (next < events.size() && events[next].cycle < end)
+        {
+            Event const& event = events[next++];
+
+            if (event.cycle > scheduler.cycles)
+            {
+                scheduler.Run(chip8, event.cycle - scheduler.cycles);
+            }
+
+            chip8.keypad[event.key & 0xF] = (event.key & 0x10) != 0;
+        }
+
+        scheduler.Run(chip8, end - scheduler.cycles);
+
+        if (end == frameEnd)
+        {
+            scheduler.EndFrame(chip8);
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size)
+{
+    if (size < 1)
+    {
+        return 0;
+    }
+
+    unsigned int eventCount = data[0] & MAX_EVENTS;
+    size_t header = 1 + 3 * eventCount;
+
+    if (size < header)
+    {
+        return 0;
+    }
+
+    // in cycle order, which the fuzzer doesn't have to get right
+    std::vector<Event> events;
+
+    for (unsigned int i = 0; i < eventCount; ++i)
+    {
+        uint8_t const* event = data + 1 + 3 * i;
+        events.push_back(Event{ static_cast<uint16_t>(event[0] | (event[1] << 8)), event[2] });
+    }
+
+    std::stable_sort(events.begin(), events.end(),
+        [](Event const& a, Event const& b) { return a.cycle < b.cycle; });
+
+    uint8_t const* rom = data + header;
+    size_t romSize = size - header;
+
+    if (romSize > Chip8::MAX_ROM_SIZE)
+    {
+        return 0;
+    }
+
+    // a new machine is most of the cost of a short run, so every
+    // run starts from a copy of one made up front instead, and the
+    // caches and their memory are only made once and flushed
+    static Chip8 const blank = []()
+    {
+        Chip8 chip8;
+        chip8.Seed(0);
+
+        return chip8;
+    }();
+
+    static Chip8 reference;
+    static Chip8 cached;
+    static Chip8 compiled;
+    static BlockCache cache;
+    static Jit jit;
+
+    reference = blank;
+    cached = blank;
+    compiled = blank;
+    cache.Flush();
+    jit.Flush();
+
+    reference.loadROM(rom, romSize);
+    cached.loadROM(rom, romSize);
+    compiled.loadROM(rom, romSize);
+
+    // the interpreter, recording where it goes
+    Scheduler referenceScheduler(INSTRUCTIONS_PER_FRAME);
+    referenceScheduler.skipIdle = false;
+    unsigned int previous = 0;
+
+    referenceScheduler.execute = [&previous](Chip8& chip8, unsigned long count)
+    {
+        for (unsigned long i = 0; i < count; ++i)
+        {
+            unsigned int address = chip8.pc & (Memory::SIZE - 1);
+
+            Hit(guestEdges[(address ^ previous) & (EDGES - 1)]);
+            Hit(guestEdges[EDGES + address]);
+            previous = address >> 1;
+
+#ifdef CHIP8_FUZZ_MAIN
+            opcodes[chip8.memory.Word(address)] = true;
+#endif
+
+            chip8.Cycle();
+        }
+
+        return count;
+    };
+
+    Run(reference, referenceScheduler, events);
+
+    // the cache, with everything the analysis finds decoded up front
+    RomAnalysis analysis;
+    analysis.Analyze(rom, romSize);
+    cache.Prewarm(cached, analysis);
+
+    Scheduler cacheScheduler(INSTRUCTIONS_PER_FRAME);
+    cacheScheduler.execute = [](Chip8& chip8, unsigned long count)
+    {
+        return cache.Run(chip8, count);
+    };
+
+    Run(cached, cacheScheduler, events);
+
+    // and the Jit, compiling blocks as it gets to them
+    Scheduler jitScheduler(INSTRUCTIONS_PER_FRAME);
+    jitScheduler.execute = [](Chip8& chip8, unsigned long count)
+    {
+        return jit.Run(chip8, count);
+    };
+
+    Run(compiled, jitScheduler, events);
+
+    uint64_t hash = reference.Hash();
+
+    if (cached.Hash() != hash || compiled.Hash() != hash)
+    {
+        std::fprintf(stderr, "Engines diverged: interpreter %016llx, cache %016llx, jit %016llx\n",
+            static_cast<unsigned long long>(hash),
+            static_cast<unsigned long long>(cached.Hash()),
+            static_cast<unsigned long long>(compiled.Hash()));
+        std::abort();
+    }
+
+    return 0;
+}
+
+#ifdef CHIP8_FUZZ_MAIN
+// Print how much of the guest programs the inputs covered
+static void Report()
+{
+    unsigned int addresses = 0;
+    unsigned int edges = 0;
+
+    for (unsigned int i = 0; i < EDGES; ++i)
+    {
+        edges += guestEdges[i] != 0;
+    }
+
+    for (unsigned int i = 0; i < Memory::SIZE; ++i)
+    {
+        addresses += guestEdges[EDGES + i] != 0;
+    }
+
+    std::vector<std::string> families;
+
+    for (unsigned int op = 0; op < 0x10000; ++op)
+    {
+        std::string family = Profile::Family(static_cast<uint16_t>(op));
+
+        if (opcodes[op] && std::find(families.begin(), families.end(), family) == families.end())
+        {
+            families.push_back(family);
+        }
+    }
+
+    std::sort(families.begin(), families.end());
+
+    std::cerr << "addresses: " << addresses << " edges: " << edges
+        << " instructions: " << families.size() << "\n";
+
+    for (std::string const& family : families)
+    {
+        std::cerr << " " << family;
+    }
+
+    std::cerr << "\n";
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        // reproduce or measure: run every file given
+        for (int i = 1; i < argc; ++i)
+        {
+            std::ifstream file(argv[i], std::ios::binary);
+
+            if (!file.is_open())
+            {
+                std::cerr << "Could not open " << argv[i] << "\n";
+                return EXIT_FAILURE;
+            }
+
+            std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        }
+
+        Report();
+
+        return EXIT_SUCCESS;
+    }
+
+#ifdef __AFL_LOOP
+    // AFL rewinds stdin between runs, so one process runs many inputs
+    while (__AFL_LOOP(10000))
+#endif
+    {
+        std::vector<uint8_t> input;
+        uint8_t buffer[4096];
+        size_t got;
+
+        while ((got = std::fread(buffer, 1, sizeof(buffer), stdin)) > 0)
+        {
+            input.insert(input.end(), buffer, buffer + got);
+        }
+
+        std::clearerr(stdin);
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+
+    return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,67 @@
+#ifndef BEEPER_H
+#define BEEPER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "ringbuffer.h"
+
+// The buzzer of a Chip8, as a stream of audio samples
+// The thread running the machine calls Frame once for every frame of
+// emulated time, which writes that frame's worth of samples: a square
+// wave while the sound timer is set, silence otherwise. The audio device
+// reads them with Fill from its own thread. Samples only ever go through
+// a lock free ring, so neither side can hold up the other.
+// Latency is bounded: when more than the configured amount of audio is
+// queued, because the machine is running ahead of real time, the new
+// samples are dropped. If the machine falls behind, the device plays
+// silence until it catches up.
+class Beeper
+{
+public:
+    // the most audio that can ever be queued, at any sample rate
+    static constexpr size_t CAPACITY = 1 << 15;
+
+    // sampleRate: samples per second
+    // frameRate: the number of times Frame is called per second of emulated time
+    // latency: the most audio queued up, in seconds
+    Beeper(unsigned int sampleRate, double frameRate, double latency);
+
+    // Write a frame of samples, from the thread running the machine
+    // on: whether the sound timer is set
+    void Frame(bool on);
+
+    // Read count samples, from the audio thread
+    // whatever hasn't been written yet is silence
+    void Fill(int16_t* samples, size_t count);
+
+    unsigned int SampleRate() const;
+
+    // the pitch of the tone, in Hz
+    double frequency{ 440.0 };
+    // the amplitude of the square wave
+    int16_t volume{ 4000 };
+
+    // the number of samples dropped because too much was queued
+    std::atomic<uint64_t> overruns{};
+    // the number of samples the device wanted before they were written
+    std::atomic<uint64_t> underruns{};
+
+private:
+    unsigned int sampleRate;
+    // samples per frame, usually fractional
+    double samplesPerFrame;
+    // the most samples queued
+    size_t maxQueued;
+
+    // owned by the producer
+    // the fraction of a sample carried over to the next frame
+    double carry{};
+    // how far through a period of the square wave it is, from 0 to 1
+    double phase{};
+
+    RingBuffer<int16_t, CAPACITY> ring;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "chip8.h"
+#include "romanalysis.h"
+
+// A cache of pre-decoded basic blocks
+// Instead of fetching and decoding memory[pc] before every instruction
+// like Chip8::Cycle does, the cache decodes a whole run of instructions
+// the first time it is entered, keyed by its start address,
+// and from then on executes the run straight from the cache.
+// A block ends at the first instruction that can change the PC
+// or write to memory, so everything inside a block runs in order.
+// Some pairs of instructions that keep coming up together are decoded
+// as a single superinstruction that does the work of both, with the PC,
+// VF and Chip8::opcode left exactly as running them one by one would.
+class BlockCache
+{
+public:
+    // the longest run of instructions decoded into one block
+    static const unsigned int MAX_BLOCK_LENGTH = 32;
+
+    // Execute up to cycles instructions on chip8, a block at a time
+    // this is equivalent to calling chip8.Cycle() the same number of times
+    // the cache consumes chip8.writtenPages to find self modified code
+    // returns the number of instructions executed
+    unsigned long Run(Chip8& chip8, unsigned long cycles);
+
+    // Drop every cached block
+    void Flush();
+
+    // Decode every block a RomAnalysis found, ahead of running them
+    // call it right after loading the ROM the analysis was made of
+    // it consumes the writtenPages loading left, and stops early
+    // rather than filling the cache
+    void Prewarm(Chip8& chip8, RomAnalysis const& analysis);
+
+    // Does this instruction have to be the last one in its block
+    // these are all the opcodes that set the PC to something other than
+    // the next instruction, or that write to memory and might hit cached code
+    static bool EndsBlock(Chip8::Handler handler);
+
+    // whether pairs of instructions are fused when they are decoded
+    // changing it only affects blocks decoded afterwards
+    bool fuse{ true };
+
+    // the number of blocks decoded so far
+    unsigned long translations{};
+    // the number of pairs fused into one superinstruction so far
+    unsigned long fusions{};
+    // the number of times cached blocks were dropped because code was written
+    unsigned long invalidations{};
+
+private:
+    // the pairs of instructions executed as one
+    // picked from the pairs the profiler finds most often in ROMs
+    enum class Fusion : uint8_t
+    {
+        // just the one instruction
+        None,
+        // Annn then Dxyn: point I at a sprite and draw it
+        IndexDraw,
+        // Fx07 then 3xkk: read the delay timer and test it
+        DelaySkip,
+        // a skip then 1nnn: a conditional jump
+        SkipJump
+    };
+
+    // a single decoded instruction, or a fused pair
+    struct DecodedOp
+    {
+        // the handler of the first instruction
+        Chip8::Handler handler;
+        uint16_t opcode;
+        // the opcode of the second instruction of a pair
+        uint16_t second;
+        Fusion fusion;
+    };
+
+    // a decoded run of instructions
+    struct Block
+    {
+        // the address of the first instruction
+        uint16_t start;
+        // the number of instructions in the block
+        uint16_t length;
+        // the number of entries in ops, which is less if any were fused
+        uint16_t size;
+        // the offset of the first instruction in ops
+        uint32_t first;
+        // the memory pages the block was decoded from
+        uint64_t pages;
+    };
+
+    // Decode the block starting at pc and add it to the cache
+    Block const& Translate(Chip8 const& chip8, uint16_t pc);
+
+    // Is there no room for another block
+    bool Full() const;
+
+    // The superinstruction a pair of instructions can be fused into
+    static Fusion Pair(Chip8::Handler first, uint16_t second);
+
+    // Execute a fused pair, which is entirely within the cycle budget
+    // returns the number of instructions executed, which is 1 if
+    // the first instruction skipped the second
+    static unsigned int RunFused(Chip8& chip8, DecodedOp const& op);
+
+    // Drop every block decoded from memory in the given pages
+    void Invalidate(uint64_t pages);
+
+    // one more than the index in blocks of the block starting at each address
+    // 0 means nothing is cached there
+    uint16_t blockAt[4096]{};
+    // every block decoded since the last flush, including dropped ones
+    std::vector<Block> blocks;
+    // storage for the instructions of every block
+    std::vector<DecodedOp> ops;
+    // the union of the pages of every block that is still cached
+    uint64_t cachedPages{};
+};
+
+#endif
@@ -1,25 +1,92 @@
 #ifndef CHIP_8
 #define CHIP_8
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <chrono>
-#include <random>
+
+#include "constants.h"
+#include "chip8memory.h"
+#include "rng.h"
+
+#ifdef CHIP8_PROFILE
+class Profile;
+#endif
+
+// OPCODE DISPATCH
+// Cycle can decode opcodes in one of three ways, chosen at build time:
+//  - by default it indexes the main table with the first nibble, and
+//    opcodes that share a first nibble take a second hop through Table0/8/E/F
+//  - CHIP8_DISPATCH_FLAT resolves all 65536 opcodes once into a single
+//    table of handlers, so every instruction is one indirect call
+//  - CHIP8_DISPATCH_SWITCH decodes with a switch statement that calls the
+//    handlers directly, which lets the compiler inline them into Cycle
+#if defined(CHIP8_DISPATCH_FLAT) && defined(CHIP8_DISPATCH_SWITCH)
+#error "Only one of CHIP8_DISPATCH_FLAT and CHIP8_DISPATCH_SWITCH may be defined"
+#endif
+
+// INSTRUCTION SET
+// Besides the original CHIP-8 instructions, the machine runs the
+// SUPER-CHIP 1.1 ones (the 128x64 display, scrolling, 16x16 sprites, the
+// big font and the user flags) and the display side of XO-CHIP: a second
+// bit plane, Fn01 to select planes and 00Dn to scroll up. The rest of
+// XO-CHIP needs 64K of memory and 4 byte instructions, which this machine
+// doesn't have.
+
+// A snapshot of the architectural state of a Chip8
+// it is a plain block of bytes, so it can be copied with memcpy,
+// written to a file as is, and compared with memcmp
+struct Chip8State
+{
+    // "C8ST", identifies a savestate
+    static const uint32_t MAGIC = 0x54533843;
+    // bumped whenever the layout changes
+    static const uint16_t VERSION = 3;
+
+    // HEADER
+    uint32_t magic;
+    uint16_t version;
+    // sizeof(Chip8State) when it was written
+    uint16_t size;
+
+    // MACHINE
+    // largest members first, so there is no padding in between
+    uint64_t video[VIDEO_PLANES][HIRES_HEIGHT][VIDEO_ROW_WORDS];
+    Rng rng;
+    uint8_t memory[4096];
+    uint16_t stack[16];
+    uint16_t index;
+    uint16_t pc;
+    uint8_t registers[16];
+    uint8_t keypad[16];
+    uint8_t flags[16];
+    uint8_t sp;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    uint8_t hires;
+    uint8_t planes;
+};
 
 class Chip8
 {   
 public:
+    // CPU STATE
+    // everything an instruction usually touches is kept together,
+    // at the start of the object and in a single 64 byte cache line
+    // so that stepping the CPU doesn't pull in the memory or display
+
     // CPU registers
-    uint8_t registers[16]{};
-    // system memory
-    uint8_t memory[4096]{};
+    alignas(64) uint8_t registers[16]{};
+    // a call stack that can hold up to 16 PC values
+    uint16_t stack[16]{};
     // 16 bit index register, used as index for memory addresses
     uint16_t index{};
     // the program counter register holds the address of the next instruction in memory
     uint16_t pc{};
-    // a call stack that can hold up to 16 PC values
-    uint16_t stack[16]{};
+    // value to hold current opcode
+    uint16_t opcode{};
     // stack pointer register
-    // indexes the call stack
+    // indexes the call stack, modulo its 16 entries
     uint8_t sp{};
     // a timer
     // any non zero value will be decremented at a constant rate
@@ -27,35 +94,79 @@ public:
     // a buzzer
     // like the timer, but also buzzes when decrementing
     uint8_t soundTimer{};
+
+
+    // MACHINE STATE
+    // a bitmap of the 64 byte memory pages written since it was last cleared
+    // bit n covers addresses [64n, 64n + 63]
+    // code caches use it to find out when a program has modified itself
+    uint64_t writtenPages{};
+    // a bitmap of the display rows that changed since it was last cleared
+    // bit n is set when row n changed, counting rows of the current resolution
+    // the frontend clears it once it has shown the changes
+    // everything starts out dirty, since nothing has been shown yet
+    uint64_t dirtyRows{ ~0ull };
     // an array that tracks keypresses
     // the chip8 had 16 keys
     uint8_t keypad[16]{};
     // an array representing the display
-    uint32_t video[64 * 32]{};
-    // value to hold current opcode
-    uint16_t opcode;
+    // every plane is a bitmap, with each row packed into 64 bit words,
+    // the leftmost pixel in the most significant bit of the first word
+    // in low resolution only the first word of the first 32 rows is used,
+    // in high resolution both words of all 64 rows
+    // a pixel's color is made up of its bits in the two planes
+    // use ExpandVideo from video.h to turn it into RGBA pixels
+    uint64_t video[VIDEO_PLANES][HIRES_HEIGHT][VIDEO_ROW_WORDS]{};
+    // whether the display is in SUPER-CHIP high resolution, 128x64
+    bool hires{};
+    // the planes that drawing, clearing and scrolling affect, one bit each
+    // XO-CHIP selects them with Fn01, everything else only uses plane 1
+    uint8_t planes{ 1 };
+    // the SUPER-CHIP user flags that Fx75 and Fx85 save registers to
+    uint8_t flags[16]{};
+    // system memory
+    // read it with memory[address], and write it with memory.Write
+    // with CHIP8_SHARED_MEMORY, copies of a machine share its memory
+    // until one of them writes to it
+    Memory memory;
 
 
-    // RNG values
-    // a basic RNG generator, seeded with the system clock
-    std::default_random_engine  randGen;
-    // a uniform int distribution will produce ints in a range [a,b]
-    // we use [0,255]
-    std::uniform_int_distribution<uint8_t> randByte;
+    // the random number generator behind OP_Cxkk
+    // it is seeded with the system clock, unless Seed is called
+    Rng rng;
+
+#ifdef CHIP8_PROFILE
+    // where Cycle records what it executes, nothing if null
+    // see profile.h
+    Profile* profile{};
+#endif
 
 
     // FUNCTION TABLES
+    // a pointer to one of the opcode functions
+    using Handler = void (Chip8::*)();
+
     // We maintain a handful of tables that are used to figure out which
     // opcode function to execute
     // One main table, and several smaller tables for special opcodes
     // All tables hold function pointers
     // and all are one element bigger than needed because it makes indexing easier
     // (no need to alter the opcode to access the right table)
-    void (Chip8::*table [0xF + 1])(){ NULL };
-    void (Chip8::*table0 [0xE + 1])(){ NULL };
-    void (Chip8::*table8 [0xE + 1])(){ NULL };
-    void (Chip8::*tableE [0xE + 1])(){ NULL };
-    void (Chip8::*tableF [0x65 + 1])(){ NULL };
+    // the sub tables cover every value of the bits used to index them
+    // so that invalid opcodes land on the null function instead of past the end
+    // the tables are the same for every machine, so they are static,
+    // and they are built at compile time
+    static const std::array<Handler, 0xF + 1> table;
+    static const std::array<Handler, 0xFF + 1> table0;
+    static const std::array<Handler, 0xF + 1> table8;
+    static const std::array<Handler, 0xF + 1> tableE;
+    static const std::array<Handler, 0xFF + 1> tableF;
+
+#ifdef CHIP8_DISPATCH_FLAT
+    // a handler for every possible opcode, resolved from the tables above
+    // opcodes with a specialized handler below get that one instead
+    static const std::array<Handler, 0x10000> flatTable;
+#endif
 
 
     // CONSTRUCTORS
@@ -65,7 +176,7 @@ public:
     // TABLE FUNCTIONS
     // These are used to figure out which operation to execute
     
-    // For opcodes beginning with 00E
+    // For opcodes beginning with 0
     void Table0();
     // For opcodes beginning with 8
     void Table8();
@@ -74,24 +185,92 @@ public:
     // For opcodes
     void TableF();
     // a dummy null function to initialize the opcode function tables with
+    void OP_NULL();
+
+    // Find the opcode function that executes an opcode
+    // this walks the tables exactly like Cycle does, without running anything
+    static Handler Decode(uint16_t op);
+
 
+    // Restart the random number generator from a fixed seed
+    // machines with the same seed, ROM and input run exactly the same
+    void Seed(uint64_t seed);
+
+
+    // where loadROM puts a program, and where it starts running
+    static const uint16_t START_ADDRESS = 0x200;
+    // the most ROM that fits in memory, from START_ADDRESS to the end
+    static const size_t MAX_ROM_SIZE = Memory::SIZE - START_ADDRESS;
 
     // Load a ROM from disk into memory
     // filename: a C string representing a file name
-    void loadROM(char const* filename);
+    // returns false if the file could not be opened or is too big
+    bool loadROM(char const* filename);
+
+    // Load a ROM that is already in memory, like a RomImage
+    // returns false, leaving memory untouched, if it is bigger than MAX_ROM_SIZE
+    bool loadROM(uint8_t const* data, size_t size);
 
     
     // Execute a single cycle of activity on the CPU
     // This includes fetching, decoding, and executing an instruction
     void Cycle();
 
+    // Fast forward through cycles instructions of an idle loop
+    // A machine is idle when the loop it is in can only be left after the
+    // timers tick or a key is pressed, which never happens in the middle
+    // of a frame: OP_Fx0A with no key pressed, a 1nnn jumping to itself,
+    // an Fx07, 3xkk, 1nnn loop polling the delay timer for kk,
+    // or a machine halted by OP_00FD.
+    // The machine ends up exactly where executing the instructions would
+    // have left it, without executing them
+    // returns false, doing nothing, if the machine isn't idle
+    bool SkipIdle(unsigned long cycles);
+
+    // Decrement the delay and sound timers if they are set
+    // the timers count down at 60Hz, independently of the CPU
+    // so this is called once per frame by the Scheduler, not by Cycle
+    void TickTimers();
+
+    // The writtenPages bits covering size bytes starting at address
+    static uint64_t PageMask(unsigned int address, unsigned int size);
+
+
+    // Take a snapshot of the machine
+    void SaveState(Chip8State& state) const;
+
+    // Restore a snapshot taken by SaveState
+    // returns false, leaving the machine untouched, if the snapshot
+    // is not a savestate of this version
+    bool LoadState(Chip8State const& state);
+
+
+    // Hash the architectural state of the machine
+    // (registers, memory, stack, timers and display) with 64 bit FNV-1a
+    // two machines with the same hash ran the same program to the same point
+    uint64_t Hash() const;
+
 
     // OPCODES
 
+    // SCD n: scroll the display down n rows
+    void OP_00Cn();
+    // SCU n: scroll the display up n rows (XO-CHIP)
+    void OP_00Dn();
     // CLS: Clear the screen
     void OP_00E0();
     // RET: Return from a subroutine
     void OP_00EE();
+    // SCR: scroll the display right 4 pixels
+    void OP_00FB();
+    // SCL: scroll the display left 4 pixels
+    void OP_00FC();
+    // EXIT: stop the program, by running this instruction forever
+    void OP_00FD();
+    // LOW: switch to the 64x32 display, clearing it
+    void OP_00FE();
+    // HIGH: switch to the 128x64 display, clearing it
+    void OP_00FF();
     // JP: jumps to location nnn, where nnn are the last three values of the opcode
     void OP_1nnn();
     // CALL: call a subroutine at nnn
@@ -138,6 +317,8 @@ public:
     // DRW Vx, Vy, n: draw n-byte sprite (n is analogous to the height) 
     // starting in memory location I, at position (Vx, Vy) in the screen
     // set VF = collision
+    // Dxy0 draws a 16x16 sprite of 32 bytes instead
+    // with more than one plane selected, each plane gets the next sprite
     void OP_Dxyn();
     // SKP Vx: skip the next instruction
     // if the key with value Vx is pressed
@@ -145,6 +326,8 @@ public:
     // SKNP Vx: skip the next instruction
     // if the key in register Vx is NOT pressed
     void OP_ExA1();
+    // PLANE n: select the planes to draw on (XO-CHIP)
+    void OP_Fn01();
     // LD Vx, DT: set Vx = delay timer value
     void OP_Fx07();
     // LD Vx, K: wait for a key press
@@ -159,6 +342,8 @@ public:
     // LD F, Vx: point I to the location of the sprite
     // for the digit who's value is in Vx
     void OP_Fx29();
+    // LD HF, Vx: point I to the 8x10 sprite for the digit in Vx
+    void OP_Fx30();
     // LD B, Vx: store the Binary Coded Decimal representation of Vx
     // in I, I+1, and I+2
     // with I being the most significant digit
@@ -169,6 +354,30 @@ public:
     // LD Vx, [I]: read from location [I, I + Vx] in memory
     // into Vx 
     void OP_Fx65();
+    // LD R, Vx: save V0 to Vx in the user flags
+    void OP_Fx75();
+    // LD Vx, R: load V0 to Vx from the user flags
+    void OP_Fx85();
+
+
+#ifdef CHIP8_DISPATCH_FLAT
+    // SPECIALIZED OPCODES
+    // the register operating opcodes again, with the registers fixed
+    // at compile time instead of extracted from the opcode
+    // the flat table holds one of these for every value of x and y
+    // they behave exactly like the opcodes above
+    template <unsigned int Vx> void OP_6xkk();
+    template <unsigned int Vx> void OP_7xkk();
+    template <unsigned int Vx, unsigned int Vy> void OP_8xy0();
+    template <unsigned int Vx, unsigned int Vy> void OP_8xy1();
+    template <unsigned int Vx, unsigned int Vy> void OP_8xy2();
+    template <unsigned int Vx, unsigned int Vy> void OP_8xy3();
+    template <unsigned int Vx, unsigned int Vy> void OP_8xy4();
+    template <unsigned int Vx, unsigned int Vy> void OP_8xy5();
+    template <unsigned int Vx> void OP_8xy6();
+    template <unsigned int Vx, unsigned int Vy> void OP_8xy7();
+    template <unsigned int Vx> void OP_8xyE();
+#endif
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef CHIP8BATCH_H
+#define CHIP8BATCH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chip8.h"
+#include "chip8pool.h"
+
+// Many machines stepped together, one instruction per machine per cycle
+// Meant for running one ROM many times over with different inputs.
+// Every machine is a lane. The registers, pc, index and timers of all the
+// lanes are stored as structure of arrays (all the V0s together, all the
+// pcs together...), and everything else stays in a Chip8 per lane.
+// Lanes that are at the same pc, about to run the same opcode, execute it
+// together in a loop over the lanes that the compiler turns into SIMD,
+// as long as it is one of the register, skip, jump or timer opcodes.
+// Any other opcode, and any lane off on its own, runs Chip8::Cycle.
+// Every lane ends up exactly where Chip8::Cycle would have taken it.
+class Chip8Batch
+{
+public:
+    // lanes: the number of machines
+    explicit Chip8Batch(size_t lanes);
+
+    // The number of machines
+    size_t Lanes() const;
+
+    // Load the same ROM into every lane
+    // returns false if the file could not be opened or is too big
+    bool LoadROM(char const* filename);
+
+    // Load the same ROM, already in memory, into every lane
+    // returns false if it is too big
+    bool LoadROM(uint8_t const* data, size_t size);
+
+    // Execute cycles instructions on every lane
+    void Run(unsigned long cycles);
+
+    // Decrement the delay and sound timers of every lane
+    void TickTimers();
+
+    // The machine of one lane, with its registers, pc, index and timers
+    // brought up to date
+    // its keypad, memory and everything else can be changed in place,
+    // but after changing the registers, pc, index or timers call Reload
+    Chip8& Machine(size_t lane);
+
+    // Pick up changes to the registers, pc, index or timers of a lane's machine
+    void Reload(size_t lane);
+
+    // the number of lane instructions executed together with other lanes
+    unsigned long vectorInstructions{};
+    // the number of lane instructions executed one lane at a time
+    unsigned long scalarInstructions{};
+
+private:
+    // the number of groups of lanes at the same instruction that are
+    // executed together each cycle, before the rest go one at a time
+    static const unsigned int MAX_GROUPS = 4;
+
+    // Execute one instruction on every lane
+    void Step();
+
+    // Execute opcode on every active lane
+    // returns false, doing nothing, if it can't be run on many lanes at once
+    bool StepLanes(uint16_t opcode);
+
+    // Execute one instruction on one lane with Chip8::Cycle
+    void StepLane(size_t lane);
+
+    size_t lanes{};
+
+    // the CPU state of every lane
+    // registers[x][lane] is Vx of that lane
+    std::array<std::vector<uint8_t>, 16> registers;
+    std::vector<uint16_t> pc;
+    std::vector<uint16_t> index;
+    std::vector<uint8_t> delayTimer;
+    std::vector<uint8_t> soundTimer;
+
+    // the rest of the state of every lane
+    Chip8Pool machines;
+
+    // scratch space for Step
+    // the opcode each lane is about to execute
+    std::vector<uint16_t> opcodes;
+    // 1 for the lanes that are still to execute this cycle
+    std::vector<uint8_t> pending;
+    // 1 for the lanes executing together, 0 for the rest
+    std::vector<uint8_t> active;
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef CHIP8MEMORY_H
+#define CHIP8MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// SHARED MEMORY
+// Memory is normally a plain array of 4K, copied along with its machine.
+// CHIP8_SHARED_MEMORY splits it into copy on write pages instead:
+// copying a Memory doesn't copy any bytes, both copies share every page,
+// and a page is only duplicated the first time one of them writes to it.
+// Pages that were never written are all the same zero page. Machines
+// copied from one that has its font and ROM loaded share those pages
+// until an instruction like Fx33 or Fx55 writes over them, so a machine
+// takes a few hundred bytes instead of 4K. Looking up the page costs
+// every instruction fetch an extra dependent load, which is why it
+// isn't the default.
+
+// The 4K of memory of a Chip8
+// addresses wrap around at 4K, so no access can land outside of memory
+class Memory
+{
+public:
+    static const unsigned int SIZE = 4096;
+    static const unsigned int PAGE_SIZE = 256;
+    static const unsigned int PAGES = SIZE / PAGE_SIZE;
+
+    // Memory that is all zeros
+    Memory();
+
+    // Read the byte at address
+    uint8_t operator[](unsigned int address) const
+    {
+        address &= SIZE - 1;
+
+        return Page(address / PAGE_SIZE)[address % PAGE_SIZE];
+    }
+
+    // Read the big endian word at address, like an instruction
+    uint16_t Word(unsigned int address) const
+    {
+        return ((*this)[address] << 8u) | (*this)[address + 1];
+    }
+
+    // Write the byte at address
+    void Write(unsigned int address, uint8_t value)
+    {
+        address &= SIZE - 1;
+
+        Writable(address / PAGE_SIZE)[address % PAGE_SIZE] = value;
+    }
+
+    // Write size bytes starting at address, wrapping around at the end
+    // shared pages that already hold exactly those bytes stay shared
+    void Write(unsigned int address, uint8_t const* data, size_t size);
+
+    // Copy size bytes starting at address out of memory
+    void Read(unsigned int address, uint8_t* data, size_t size) const;
+
+    // The bytes of one page, for reading
+    uint8_t const* Page(unsigned int page) const
+    {
+#ifdef CHIP8_SHARED_MEMORY
+        return bytes[page];
+#else
+        return bytes + page * PAGE_SIZE;
+#endif
+    }
+
+    // Does every byte match
+    bool operator==(Memory const& other) const;
+    bool operator!=(Memory const& other) const;
+
+    // The number of pages no other memory shares
+    // without CHIP8_SHARED_MEMORY that is every page
+    unsigned int PrivatePages() const;
+
+private:
+    // A page that can be written to, duplicating it first if it is shared
+    uint8_t* Writable(unsigned int page)
+    {
+#ifdef CHIP8_SHARED_MEMORY
+        if (pages[page].use_count() != 1)
+        {
+            Unshare(page);
+        }
+
+        return bytes[page];
+#else
+        return bytes + page * PAGE_SIZE;
+#endif
+    }
+
+#ifdef CHIP8_SHARED_MEMORY
+    struct Block
+    {
+        uint8_t bytes[PAGE_SIZE];
+    };
+
+    // Give this memory its own copy of a shared page
+    void Unshare(unsigned int page);
+
+    // the pages, which may be shared with other memories
+    std::shared_ptr<Block> pages[PAGES];
+    // the bytes of each page, to avoid going through the shared pointers
+    uint8_t* bytes[PAGES];
+#else
+    uint8_t bytes[SIZE]{};
+#endif
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef CHIP8POOL_H
+#define CHIP8POOL_H
+
+#include <cstddef>
+#include <memory>
+
+#include "chip8.h"
+
+// A fixed number of machines stored back to back in one allocation
+// Every Chip8 starts on a cache line of its own, so machines run by
+// different threads never share a line, and the CPU state of each machine
+// is one line away from the previous machine's memory instead of on the heap
+// somewhere else. Machines are reused by resetting them in place.
+class Chip8Pool
+{
+public:
+    // count: the number of machines in the pool
+    explicit Chip8Pool(size_t count);
+
+    // The number of machines in the pool
+    size_t Size() const;
+
+    Chip8& operator[](size_t i);
+    Chip8 const& operator[](size_t i) const;
+
+    // Put machine i back the way a newly constructed Chip8 is
+    // returns the machine
+    Chip8& Reset(size_t i);
+
+private:
+    std::unique_ptr<Chip8[]> machines;
+    size_t count{};
+};
+
+#endif
@@ -3,7 +3,18 @@
 
 #include <cstdint>
 
-inline const uint8_t VIDEO_WIDTH = 32;
-inline const uint8_t VIDEO_HEIGHT = 64;
+// the display of the original CHIP-8, and of SUPER-CHIP in low resolution
+inline const uint8_t VIDEO_WIDTH = 64;
+inline const uint8_t VIDEO_HEIGHT = 32;
 
-#endif
\ No newline at end of file
+// the SUPER-CHIP high resolution display, twice as wide and tall
+inline const uint8_t HIRES_WIDTH = 128;
+inline const uint8_t HIRES_HEIGHT = 64;
+
+// the number of 64 bit words a packed row of the display takes at most
+inline const uint8_t VIDEO_ROW_WORDS = HIRES_WIDTH / 64;
+
+// XO-CHIP draws on two bit planes, which together give four colors
+inline const uint8_t VIDEO_PLANES = 2;
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef FRAMEDELTA_H
+#define FRAMEDELTA_H
+
+#include <cstdint>
+#include <vector>
+
+#include "video.h"
+
+// The changes to a packed display, as bytes to send to somewhere else
+// A delta is the resolution, a mask of the rows it holds, and then those
+// rows in order, each one every plane's words of the row at the current
+// resolution: one word per plane in low resolution, two in high. Rows
+// that didn't change aren't sent at all, so a frame where a sprite moved
+// takes a few dozen bytes instead of the whole 2KB display.
+// Everything is little endian byte by byte, so any host can read it.
+// A change of resolution clears the screen and marks every row dirty,
+// so applying the deltas in order always rebuilds the same display.
+
+// Append the rows of video set in rowMask to out
+// rowMask counts rows of the current resolution, as in Chip8::dirtyRows,
+// and bits past the last row are ignored
+void EncodeFrameDelta(std::vector<uint8_t>& out, PackedVideo const& video, bool hires, uint64_t rowMask);
+
+// The number of bytes EncodeFrameDelta appends for these rows
+size_t FrameDeltaSize(bool hires, uint64_t rowMask);
+
+// Apply a delta read from data to video and hires, advancing data
+// returns false, leaving both as they were, if the delta is cut short
+bool DecodeFrameDelta(uint8_t const*& data, uint8_t const* end, PackedVideo& video, bool& hires);
+
+#endif
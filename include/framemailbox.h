@@ -0,0 +1,85 @@
+#ifndef FRAMEMAILBOX_H
+#define FRAMEMAILBOX_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include "constants.h"
+
+// Finished frames handed from the thread running the machine
+// to the thread presenting them
+// It is a triple buffer: the producer draws into the back frame, the
+// consumer shows the front frame, and the one in the middle holds the
+// latest frame published. Publishing swaps the back frame with the
+// middle, taking swaps the front with it, and each of those is a single
+// atomic exchange, so neither thread ever waits for the other. If the
+// producer publishes again before the consumer took the last frame, that
+// frame is dropped, and the consumer always gets the latest one.
+// The counters are updated by the thread that owns them, so only read
+// them once both threads are done.
+class FrameMailbox
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Frame
+    {
+        // the display, packed like Chip8::video
+        uint64_t video[VIDEO_PLANES][HIRES_HEIGHT][VIDEO_ROW_WORDS];
+        // as in Chip8::hires
+        bool hires;
+        // counts up from 1 with every frame published
+        uint64_t number;
+        // when it was published
+        Clock::time_point published;
+    };
+
+    // The frame to draw the next frame into, from the producer thread
+    // it still holds whatever was drawn into it last time
+    Frame& Back();
+
+    // Publish the back frame, from the producer thread
+    void Publish();
+
+    // The latest frame, from the consumer thread
+    // returns nullptr if nothing was published since the last call
+    // it stays valid until the next call
+    Frame const* Take();
+
+    // Record that the frame last taken is now on screen, from the consumer thread
+    void Presented();
+
+    // Write frame and latency statistics
+    void Report(std::ostream& out) const;
+
+    // PRODUCER COUNTERS
+    // the number of frames published
+    uint64_t published{};
+    // the number of frames replaced by a later one before they were taken
+    uint64_t dropped{};
+
+    // CONSUMER COUNTERS
+    // the number of frames presented
+    uint64_t presented{};
+    // the time from publishing to presenting, in seconds
+    double latencySum{};
+    double latencyMax{};
+
+private:
+    // set on the middle index while the frame there hasn't been taken
+    static const unsigned int FRESH = 4;
+
+    Frame frames[3]{};
+
+    // owned by the producer
+    unsigned int back{ 0 };
+    // owned by the consumer
+    unsigned int front{ 1 };
+    Frame const* taken{};
+    // shared, the index of the middle frame and FRESH
+    std::atomic<unsigned int> middle{ 2 };
+};
+
+#endif
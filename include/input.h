@@ -0,0 +1,22 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <chrono>
+#include <cstdint>
+
+#include "ringbuffer.h"
+
+// A key of the keypad going down or up, and when it did
+struct KeyEvent
+{
+    std::chrono::steady_clock::time_point time;
+    // 0 to 0xF
+    uint8_t key;
+    bool pressed;
+};
+
+// Key events on their way from the thread handling input
+// to the thread running the machine
+using KeyQueue = RingBuffer<KeyEvent, 256>;
+
+#endif
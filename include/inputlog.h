@@ -0,0 +1,65 @@
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A recording of the input of one run of a ROM
+// A machine is deterministic given its ROM, the seed of its random number
+// generator and the number of instructions per frame, so those, plus
+// every keypad change and the cycle it happened at, are all it takes to
+// run the exact same session again.
+// On disk it is a small header followed by the events, each one the
+// number of cycles since the previous event as a variable length
+// integer and a byte for the key, so a long session takes a few KB.
+class InputLog
+{
+public:
+    // "C8IN", identifies an input log
+    static const uint32_t MAGIC = 0x4E493843;
+    // bumped whenever the format changes
+    // version 2 added frameFraction, and version 1 logs still load
+    static const uint16_t VERSION = 2;
+
+    // A key of the keypad going down or up
+    struct Event
+    {
+        // the number of instructions run before it happened
+        uint64_t cycle;
+        // 0 to 0xF
+        uint8_t key;
+        bool pressed;
+    };
+
+    // Add an event, which can't be before the last one
+    void Record(uint64_t cycle, uint8_t key, bool pressed);
+
+    // Write the log to a file
+    // returns false if it couldn't be written
+    bool Save(char const* filename) const;
+
+    // Replace the log with one read from a file
+    // returns false, leaving the log untouched, if the file couldn't be
+    // read or isn't an input log of this version or an older one
+    bool Load(char const* filename);
+
+    // A 64 bit FNV-1a hash of a ROM, to tell whether a log was recorded with it
+    static uint64_t HashRom(uint8_t const* data, size_t size);
+
+    // the seed the machine's random number generator was started with
+    uint64_t seed{};
+    // what HashRom made of the ROM
+    uint64_t romHash{};
+    // the number of instructions between timer ticks
+    uint32_t instructionsPerFrame{};
+    // and the fraction of one on top, as in Scheduler::frameFraction
+    uint32_t frameFraction{};
+    // the length of the session in instructions
+    uint64_t cycles{};
+
+    // every keypad change, in order
+    std::vector<Event> events;
+};
+
+#endif
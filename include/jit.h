@@ -0,0 +1,118 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "chip8.h"
+#include "romanalysis.h"
+
+// The recompiler is only available on x86-64 hosts with mmap
+// everywhere else the Jit runs the interpreter instead
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define CHIP8_JIT_X64
+#endif
+
+// A dynamic recompiler
+// Basic blocks are found the same way as in the BlockCache,
+// translated into native code the first time they run, and then called
+// directly. Loads, stores, register ALU ops, jumps and the index opcodes
+// are compiled into each block, and everything else (drawing, random
+// numbers, keys, the timers, calls...) is compiled into a call
+// back to the interpreter's opcode function.
+class Jit
+{
+public:
+    Jit();
+    ~Jit();
+
+    Jit(Jit const&) = delete;
+    Jit& operator=(Jit const&) = delete;
+
+    // Is native code actually generated on this host
+    // if not, the Jit falls back to Chip8::Cycle
+    bool Native() const;
+
+    // Execute up to cycles instructions of chip8
+    // this is equivalent to calling chip8.Cycle() the same number of times
+    // the Jit consumes chip8.writtenPages to find self modified code
+    // returns the number of instructions executed
+    unsigned long Run(Chip8& chip8, unsigned long cycles);
+
+    // Execute a single block, or a single instruction if no whole block
+    // fits in the cycle budget
+    // returns the number of instructions executed
+    unsigned long Step(Chip8& chip8, unsigned long cycles);
+
+    // Conformance mode: run the Jit on chip8 and the interpreter on
+    // reference side by side, comparing their state after every block
+    // both machines should start out identical
+    // returns the number of instructions after which both still agreed,
+    // which is cycles if they never diverged
+    unsigned long Lockstep(Chip8& chip8, Chip8& reference, unsigned long cycles);
+
+    // Drop all generated code
+    void Flush();
+
+    // Compile every block a RomAnalysis found, ahead of running them
+    // the same as BlockCache::Prewarm
+    void Prewarm(Chip8& chip8, RomAnalysis const& analysis);
+
+    // the number of blocks compiled so far
+    unsigned long translations{};
+    // the number of times compiled blocks were dropped because code was written
+    unsigned long invalidations{};
+
+    // an instruction the generated code hands back to the interpreter
+    struct Call
+    {
+        Chip8::Handler handler;
+        uint16_t opcode;
+        // the address of the next instruction
+        uint16_t next;
+    };
+
+private:
+    // a block of generated code
+    struct Block
+    {
+        // the address of the first instruction
+        uint16_t start;
+        // the number of instructions in the block
+        uint16_t length;
+        // the memory pages the block was compiled from
+        uint64_t pages;
+        // the generated code
+        void (*code)(Chip8*);
+    };
+
+    // Compile the block starting at pc
+    // returns nullptr if there is no room left for it
+    Block const* Translate(Chip8 const& chip8, uint16_t pc);
+
+    // Is there no room for another block
+    bool Full() const;
+
+    // Drop every block compiled from memory in the given pages
+    void Invalidate(uint64_t pages);
+
+    // executable memory for the generated code
+    uint8_t* code{};
+    // the number of bytes of code in use
+    size_t codeUsed{};
+    // the instructions handed back to the interpreter
+    // these have a fixed capacity because generated code points into them
+    std::unique_ptr<Call[]> calls;
+    size_t callsUsed{};
+    // one more than the index in blocks of the block starting at each address
+    // 0 means nothing is compiled there
+    uint16_t blockAt[4096]{};
+    // every block compiled since the last flush, including dropped ones
+    std::vector<Block> blocks;
+    // the union of the pages of every block that is still compiled
+    uint64_t cachedPages{};
+};
+
+#endif
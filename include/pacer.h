@@ -0,0 +1,55 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Paces a loop to a fixed frame rate
+// Instead of polling the clock, Wait sleeps until the next frame deadline.
+// Every frame, the pacer records how far the actual frame start was
+// from where it should have been, which is reported as jitter
+class FramePacer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // frameRate: the number of frames per second to pace to
+    explicit FramePacer(double frameRate);
+
+    // Sleep until the next frame is due
+    // if the loop has fallen more than a frame behind, the deadlines are
+    // moved up to now rather than rushing through the missed frames
+    void Wait();
+
+    // Record the start of a frame paced by something else, like vsync
+    // a Wait straight after it sleeps until one period after this frame
+    // returns the seconds since the previous frame
+    double Mark();
+
+    // Write frame count and jitter statistics in milliseconds
+    void Report(std::ostream& out) const;
+
+    // the number of frames recorded
+    uint64_t frames{};
+    // the number of deadlines that were missed by a whole frame or more
+    uint64_t missed{};
+
+private:
+    // record one frame that started error seconds late (or early if negative)
+    void Record(double error);
+
+    // the length of a frame
+    Clock::duration period;
+    // when the next frame is due
+    Clock::time_point deadline;
+    // when the last frame started
+    Clock::time_point last;
+
+    // running sums of the timing error, for the mean and deviation
+    double errorSum{};
+    double errorSquaredSum{};
+    double errorMax{};
+};
+
+#endif
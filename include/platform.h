@@ -3,24 +3,66 @@
 
 #include <SDL2/SDL.h>
 
+#include "beeper.h"
+#include "input.h"
+
 class Platform
 {
 private:
     SDL_Window* window{};
     SDL_Renderer* renderer{};
     SDL_Texture* texture{};
+    int textureWidth{};
+    int textureHeight{};
+    // whether the rewind key is held down
+    bool rewindHeld{};
+    // the device playing a Beeper, 0 if there is none
+    SDL_AudioDeviceID audioDevice{};
+
+    // Handle one SDL event
+    // the keypad key it pressed or released goes in key and pressed,
+    // or key is -1 if it wasn't one
+    // returns true if it asked to quit
+    bool HandleEvent(SDL_Event const& event, int& key, bool& pressed);
 
 public:
     Platform(char const* title,
         int windowWidth,
         int windowHeight,
         int textureWidth,
-        int textureHeight);
+        int textureHeight,
+        bool vsync = false);
 
     ~Platform();
 
     void Update(void const* buffer, int pitch);
+    // Like Update, but only upload the rows set in rowMask
+    // bit n of rowMask is row n of the texture
+    void Update(void const* buffer, int pitch, uint64_t rowMask);
+
+    // Zero copy presenting: lock the streaming texture and draw straight into it
+    // returns the first pixel, and the distance between rows in bytes in pitch
+    // SDL does not keep the old contents, so every pixel has to be written
+    void* LockFrame(int& pitch);
+    // Unlock the texture locked by LockFrame and present it
+    void PresentFrame();
     bool ProcessInput(uint8_t* keys);
+    // Like ProcessInput, but send the key presses and releases to another
+    // thread, timestamped, instead of changing the keypad
+    // waits up to timeout milliseconds for the first event
+    // returns true when it is time to quit
+    bool ProcessInput(KeyQueue& events, int timeout);
+    // Is the rewind key (backspace) held down, as of the last ProcessInput
+    bool RewindHeld() const;
+    // Change the title of the window
+    void SetTitle(char const* title);
+
+    // Start playing a Beeper on the default audio device
+    // the device asks for bufferSamples samples at a time, which adds to
+    // the latency of the beeper's own queue
+    // the beeper has to outlive the platform
+    // returns false if there is no audio device to play it on
+    bool OpenAudio(Beeper& beeper, unsigned int bufferSamples);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,85 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <ostream>
+
+#include "chip8memory.h"
+
+// PROFILING
+// Building with CHIP8_PROFILE (make PROFILE=1) makes Chip8::Cycle record
+// every instruction it executes into the Profile its profile member
+// points to, if any. Without it the machine has no profile member and
+// Cycle is exactly the same as before, so profiling costs nothing unless
+// it was built in.
+// Only Chip8::Cycle is profiled. The BlockCache and the Jit run most
+// instructions without it, so profile ROMs on the interpreter.
+
+// What a machine spent its time on
+// every machine pointing at the same Profile adds to it
+class Profile
+{
+public:
+    // Record an instruction that is about to execute
+    // address: where it was fetched from
+    void Executed(unsigned int address, uint16_t opcode)
+    {
+        address &= Memory::SIZE - 1;
+
+        ++opcodes[opcode];
+        ++addresses[address];
+        lastOpcode[address] = opcode;
+
+        // a pair of instructions run back to back could be fused
+        if (address == previous + 2)
+        {
+            ++followed[previous];
+        }
+
+        previous = address;
+    }
+
+    // Forget everything recorded so far
+    void Clear();
+
+    // The total number of instructions recorded
+    uint64_t Instructions() const;
+
+    // The name of the instruction an opcode belongs to, like "8xy4"
+    // opcodes that aren't instructions are "invalid"
+    static char const* Family(uint16_t opcode);
+
+    // Write everything as a JSON object
+    // the instruction counts by family and by address, busiest first,
+    // the pairs of families most often run back to back,
+    // the time spent drawing and how long OP_Fx0A waited for keys
+    void WriteJson(std::ostream& out) const;
+
+    // Write the instruction counts as folded stacks, one
+    // "chip8;<family>;<address> <count>" line per address, which
+    // flamegraph.pl and most other flame graph tools read as they are
+    // each address is attributed to the last opcode fetched from it
+    void WriteFolded(std::ostream& out) const;
+
+    // the number of times each opcode was executed
+    uint64_t opcodes[0x10000]{};
+    // the number of instructions fetched from each address
+    uint64_t addresses[Memory::SIZE]{};
+    // the last opcode fetched from each address
+    // only differs from what the ROM loaded there if the program modified it
+    uint16_t lastOpcode[Memory::SIZE]{};
+    // the number of times the instruction at each address was followed
+    // by the one right after it, which are the pairs BlockCache can fuse
+    // machines sharing a profile break up each other's pairs a little
+    uint64_t followed[Memory::SIZE]{};
+    // the address of the last instruction recorded
+    unsigned int previous{ Memory::SIZE };
+
+    // the time spent in OP_Dxyn, in nanoseconds
+    uint64_t drawNanoseconds{};
+    // the number of times OP_Fx0A ran without finding a key pressed,
+    // and so will run again
+    uint64_t keyWaits{};
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "chip8.h"
+
+// A rewind history of savestates
+// Push records a frame and Pop steps back to the last recorded one.
+// Every keyframeInterval frames a whole savestate is kept, and every frame
+// in between only stores how it differs from that keyframe: the two
+// states are XORed together, which leaves mostly zeroes, and the zeroes
+// are run length encoded away.
+// Everything is stored in a fixed arena allocated up front, and once it
+// is full the oldest frames are dropped, so recording never allocates.
+class Rewind
+{
+public:
+    // arenaBytes: the memory used for encoded frames
+    // maxFrames: the most frames kept, regardless of how small they are
+    // keyframeInterval: the number of frames between keyframes
+    Rewind(size_t arenaBytes, size_t maxFrames, unsigned int keyframeInterval);
+
+    // Record the current state of a machine
+    void Push(Chip8 const& chip8);
+
+    // Restore the most recently recorded state and forget it
+    // returns false if there is no history left
+    bool Pop(Chip8& chip8);
+
+    // the number of frames in the history
+    size_t Frames() const;
+    // the number of arena bytes holding encoded frames
+    size_t BytesUsed() const;
+
+private:
+    // where a recorded frame lives in the arena
+    struct Entry
+    {
+        size_t offset;
+        size_t length;
+        // the slot of the keyframe a delta is relative to
+        // a keyframe points at itself
+        size_t keyframe;
+    };
+
+    // Encode the XOR of state and base into scratch
+    // returns the encoded length
+    size_t Encode(Chip8State const& state, Chip8State const& base);
+
+    // Decode an entry and XOR it into state
+    void Decode(Entry const& entry, Chip8State& state) const;
+
+    // Drop the oldest frame, and any frames that were relative to it
+    void DropOldest();
+
+    // the encoded frames
+    std::unique_ptr<uint8_t[]> arena;
+    size_t arenaSize;
+    // where the next frame is written
+    size_t writeOffset{};
+
+    // a ring of the recorded frames, oldest first
+    std::unique_ptr<Entry[]> entries;
+    size_t entryCapacity;
+    size_t first{};
+    size_t count{};
+
+    // the most recent keyframe, which new deltas are relative to
+    Chip8State keyframe{};
+    // the slot of that keyframe
+    size_t keyframeSlot{};
+    // frames recorded since that keyframe,
+    // or keyframeInterval if the next frame has to be a keyframe
+    unsigned int sinceKeyframe;
+    unsigned int keyframeInterval;
+
+    // room to encode one frame into before it is copied into the arena
+    std::unique_ptr<uint8_t[]> scratch;
+};
+
+#endif
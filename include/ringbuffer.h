@@ -0,0 +1,131 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+
+// A fixed size lock free queue between exactly two threads
+// One thread only ever pushes and the other only ever pops, so each end
+// is owned by one thread and the two only meet through the atomic head
+// and tail, which are kept on separate cache lines. Nothing blocks:
+// pushing to a full queue and popping from an empty one just fail.
+template <typename T, size_t Capacity>
+class RingBuffer
+{
+    static_assert(Capacity && (Capacity & (Capacity - 1)) == 0,
+        "the capacity must be a power of two");
+
+public:
+    // Add an item at the back, from the producer thread
+    // returns false, doing nothing, if the queue is full
+    bool Push(T const& item)
+    {
+        size_t back = tail.load(std::memory_order_relaxed);
+
+        if (back - head.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+
+        items[back & (Capacity - 1)] = item;
+        // the item has to be written before the consumer can see it
+        tail.store(back + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Add up to count items at the back, from the producer thread
+    // returns how many there was room for
+    size_t Push(T const* data, size_t count)
+    {
+        size_t back = tail.load(std::memory_order_relaxed);
+        size_t room = Capacity - (back - head.load(std::memory_order_acquire));
+
+        count = count < room ? count : room;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            items[(back + i) & (Capacity - 1)] = data[i];
+        }
+
+        tail.store(back + count, std::memory_order_release);
+
+        return count;
+    }
+
+    // The item at the front, from the consumer thread
+    // returns nullptr if the queue is empty
+    // it stays valid until it is popped
+    T const* Front() const
+    {
+        size_t front = head.load(std::memory_order_relaxed);
+
+        if (front == tail.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+
+        return &items[front & (Capacity - 1)];
+    }
+
+    // Remove the item at the front, from the consumer thread
+    // returns false, doing nothing, if the queue is empty
+    bool Pop(T& item)
+    {
+        T const* front = Front();
+
+        if (!front)
+        {
+            return false;
+        }
+
+        item = *front;
+        Pop();
+
+        return true;
+    }
+
+    // Remove up to count items from the front, from the consumer thread
+    // returns how many there were
+    size_t Pop(T* data, size_t count)
+    {
+        size_t front = head.load(std::memory_order_relaxed);
+        size_t available = tail.load(std::memory_order_acquire) - front;
+
+        count = count < available ? count : available;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            data[i] = items[(front + i) & (Capacity - 1)];
+        }
+
+        head.store(front + count, std::memory_order_release);
+
+        return count;
+    }
+
+    // Remove the item at the front without looking at it
+    // the queue must not be empty
+    void Pop()
+    {
+        // the item has to be read before the producer can reuse its slot
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // The number of items in the queue
+    // only a snapshot if the other thread is using the queue
+    size_t Size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    // the position of the next item to pop, only written by the consumer
+    alignas(64) std::atomic<size_t> head{};
+    // the position of the next item to push, only written by the producer
+    alignas(64) std::atomic<size_t> tail{};
+    // positions only ever grow, and wrap around the items
+    alignas(64) T items[Capacity];
+};
+
+#endif
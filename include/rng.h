@@ -0,0 +1,48 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// A small, fast random number generator (PCG32, XSH RR)
+// The whole generator is two integers, so it can be copied, saved with
+// the rest of the machine and compared like any other state. The same
+// seed always produces the same sequence, on every platform.
+class Rng
+{
+public:
+    // Restart the sequence from seed
+    // different streams give unrelated sequences from the same seed
+    void Seed(uint64_t seed, uint64_t stream = 0)
+    {
+        // the increment has to be odd
+        increment = (stream << 1u) | 1u;
+        state = 0;
+        Next();
+        state += seed;
+        Next();
+    }
+
+    // The next 32 random bits
+    uint32_t Next()
+    {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + increment;
+
+        // drop the weak low bits and rotate by the strongest ones
+        uint32_t xorShifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        uint32_t rotation = static_cast<uint32_t>(old >> 59u);
+
+        return (xorShifted >> rotation) | (xorShifted << ((32u - rotation) & 31u));
+    }
+
+    // A random byte, uniform over [0, 255]
+    uint8_t Byte()
+    {
+        return static_cast<uint8_t>(Next() >> 24u);
+    }
+
+    uint64_t state{};
+    uint64_t increment{ 1 };
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef ROMANALYSIS_H
+#define ROMANALYSIS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "chip8.h"
+
+// A static pass over a ROM, before it runs
+// Disassembles everything reachable from Chip8::START_ADDRESS by following
+// jumps, calls, returns to the instruction after a call, and both ways out
+// of every skip. That splits the code into basic blocks, and whatever part
+// of the ROM is never reached is data. Blocks that the flow of control
+// comes back around to are marked as loop headers.
+// Bnnn jumps to an address computed at run time, so the code it leads to
+// isn't found, and neither is code only reached by returning from a
+// subroutine that was entered some other way. The blocks found are still
+// all real entry points, which is what BlockCache::Prewarm and
+// Jit::Prewarm need to translate them before the program gets there.
+class RomAnalysis
+{
+public:
+    // a straight run of instructions, entered only at the top
+    struct Block
+    {
+        // the address of the first instruction
+        uint16_t start;
+        // the number of instructions in the block
+        uint16_t length;
+        // the blocks control can go to next, by start address
+        // a call has the subroutine first and the return address second
+        uint16_t successors[2];
+        uint8_t successorCount;
+        // whether control comes back around to this block
+        bool loop;
+        // whether it ends with a jump the analysis can't follow:
+        // Bnnn, or a return from a subroutine
+        bool indirect;
+    };
+
+    // a range of the ROM that is never run
+    struct Region
+    {
+        uint16_t start;
+        uint16_t size;
+    };
+
+    // Analyze a ROM as it would be loaded by Chip8::loadROM
+    // replaces the results of any earlier analysis
+    void Analyze(uint8_t const* data, size_t size);
+
+    // The block starting at address, or nullptr if there isn't one
+    Block const* BlockAt(uint16_t address) const;
+
+    // every block, ordered by start address
+    std::vector<Block> blocks;
+    // every range of the ROM that isn't code, ordered by address
+    std::vector<Region> data;
+    // the number of instructions reached
+    unsigned int instructions{};
+    // the number of blocks that are loop headers
+    unsigned int loops{};
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef ROMCACHE_H
+#define ROMCACHE_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "romimage.h"
+
+// ROM images shared by path
+// Every file is opened once, the first time it is asked for, and the
+// same image is handed to everything that loads it after that.
+// Safe to use from many threads at once.
+class RomCache
+{
+public:
+    // The image of a ROM file
+    // returns nullptr if the file could not be opened
+    // failures aren't cached, so a later call tries again
+    std::shared_ptr<RomImage const> Get(std::string const& path);
+
+    // Forget every image
+    // images still in use stay alive until they are released
+    void Clear();
+
+    // The number of images in the cache
+    size_t Size() const;
+
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<RomImage const>> images;
+};
+
+#endif
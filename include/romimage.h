@@ -0,0 +1,50 @@
+#ifndef ROMIMAGE_H
+#define ROMIMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ROM files are mapped into memory where mmap is available
+// everywhere else they are read into a buffer instead
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_ROM_MMAP
+#endif
+
+// The contents of a ROM file
+// The file is mapped read only, so opening it doesn't copy anything,
+// and loading it into a machine is a single copy straight from the page
+// cache into the machine's memory. The mapping lasts as long as the image.
+class RomImage
+{
+public:
+    // Open a ROM file
+    // check Loaded to find out whether that worked
+    explicit RomImage(char const* filename);
+    ~RomImage();
+
+    RomImage(RomImage const&) = delete;
+    RomImage& operator=(RomImage const&) = delete;
+
+    // Could the file be opened
+    bool Loaded() const;
+
+    // The bytes of the file
+    // nullptr if the file is empty or couldn't be opened
+    uint8_t const* Data() const;
+
+    // The size of the file in bytes
+    size_t Size() const;
+
+private:
+    uint8_t const* data{};
+    size_t size{};
+    bool loaded{};
+
+#ifndef CHIP8_ROM_MMAP
+    // the contents of the file, on hosts without mmap
+    std::vector<uint8_t> buffer;
+#endif
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+#include "chip8.h"
+
+// Runs a Chip8 in frames of emulated time
+// Each frame executes a fixed number of instructions and then ticks the
+// timers once, so the timers always count down at 60Hz of emulated time
+// no matter how fast the CPU is configured to run. A rate that isn't a
+// whole number of instructions per frame alternates between the two
+// nearest frame lengths, in a pattern that only depends on the rate.
+// Once the machine is idle, waiting for a key or for the delay timer,
+// the rest of the frame is skipped instead of executed, which leaves it
+// in exactly the same state without spending host time on it.
+class Scheduler
+{
+public:
+    // the rate the delay and sound timers count down at
+    static constexpr double FRAME_RATE = 60.0;
+
+    using Clock = std::chrono::steady_clock;
+
+    // instructionsPerFrame: how many instructions run between timer ticks
+    explicit Scheduler(unsigned int instructionsPerFrame);
+
+    // Run instructionsPerSecond instructions per second of emulated time
+    // sets instructionsPerFrame and frameFraction, and starts the
+    // pattern of frame lengths over
+    void SetRate(double instructionsPerSecond);
+
+    // The number of instructions in the current frame
+    unsigned long FrameLength() const;
+
+    // Run a single frame
+    void RunFrame(Chip8& chip8);
+
+    // Run count instructions of the current frame, without ending it
+    // so that something like a key press can happen part way through
+    // a frame is still instructionsPerFrame long, so the counts of all
+    // the calls before an EndFrame should add up to that
+    void Run(Chip8& chip8, unsigned long count);
+
+    // End the current frame, ticking the timers
+    void EndFrame(Chip8& chip8);
+
+    // Catch emulated time up to the host
+    // seconds: the host time that passed since the last call
+    // runs however many whole frames have become due, up to maxCatchUp,
+    // and carries any remainder over to the next call.
+    // If the host has fallen further behind than that, the extra time is
+    // dropped instead of being made up in a burst later.
+    // Either way the machine only ever advances a whole frame at a time,
+    // so its state depends only on the number of frames run
+    // returns the number of frames run
+    unsigned int Advance(Chip8& chip8, double seconds);
+
+    // Fast forward: run whole frames as quickly as possible until deadline
+    // always runs at least one frame
+    // returns the number of frames run
+    unsigned int RunUntil(Chip8& chip8, Clock::time_point deadline);
+
+    // how many instructions run in a frame
+    unsigned int instructionsPerFrame;
+    // the fraction of an instruction per frame on top of that, in
+    // 1/2^32ths, which adds an instruction every time it adds up to one
+    uint32_t frameFraction{};
+    // the most frames a single call to Advance will run
+    unsigned int maxCatchUp{ 4 };
+    // how instructions are executed
+    // it is given the machine and a number of cycles to run, and returns
+    // how many it ran. By default this is a loop over Chip8::Cycle
+    std::function<unsigned long(Chip8&, unsigned long)> execute;
+    // called at the end of every frame, before the timers tick, if set
+    // the machine looks like it did for the whole frame, so this is
+    // where to sample anything that lasts a frame, like the sound timer
+    std::function<void(Chip8&)> endOfFrame;
+
+    // whether to skip the rest of a frame once the machine is idle
+    // see Chip8::SkipIdle
+    bool skipIdle{ true };
+    // the most instructions executed between checks for an idle machine
+    unsigned int idleCheckInterval{ 256 };
+
+    // the number of frames run so far
+    uint64_t frames{};
+    // the number of instructions run so far
+    uint64_t cycles{};
+    // the number of those instructions skipped because the machine was idle
+    uint64_t idleCycles{};
+    // the number of frames skipped because the host fell behind
+    uint64_t droppedFrames{};
+
+private:
+    // emulated time that is due but hasn't been run yet, in frames
+    double pending{};
+    // frameFraction added up over the frames so far, less the instructions
+    // it added, in 1/2^32ths
+    uint32_t fractionCarry{};
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef THROUGHPUT_H
+#define THROUGHPUT_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Measures how fast the machine runs in millions of instructions per second
+// Sample is given the instruction counts so far every frame, and about
+// once a second works out the rate over the last second. Instructions an
+// idle machine skipped count as run, since the program got just as far,
+// but the rate of the ones actually executed is kept too.
+class Throughput
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // interval: how often to work out a new rate, in seconds
+    explicit Throughput(double interval = 1.0);
+
+    // Record the instructions run so far
+    // cycles: all of them, as in Scheduler::cycles
+    // idleCycles: the ones skipped, as in Scheduler::idleCycles
+    // returns true when there is a new rate
+    bool Sample(uint64_t cycles, uint64_t idleCycles);
+
+    // the rate over the last interval, including skipped instructions
+    double mips{};
+    // the rate of the instructions that were actually executed
+    double executedMips{};
+
+    // Write the rate over the whole run
+    void Report(std::ostream& out) const;
+
+private:
+    Clock::duration interval;
+    Clock::time_point start;
+    // the time and the counts of the last new rate
+    Clock::time_point last;
+    uint64_t lastCycles{};
+    uint64_t lastIdleCycles{};
+    // the counts of the latest sample
+    uint64_t cycles{};
+    uint64_t idleCycles{};
+};
+
+#endif
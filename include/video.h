@@ -0,0 +1,31 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <cstdint>
+
+#include "constants.h"
+
+// The display as packed in Chip8::video
+using PackedVideo = uint64_t[VIDEO_PLANES][HIRES_HEIGHT][VIDEO_ROW_WORDS];
+
+// Expand the packed display into 32 bit RGBA8888 pixels
+// the output is always HIRES_WIDTH x HIRES_HEIGHT pixels, so at low
+// resolution every pixel of the display becomes a 2x2 block
+// a pixel is black when it is off in every plane, white when it is only
+// on in the first plane, and one of two greys otherwise
+// video: the packed display
+// hires: whether it is at high resolution, as in Chip8::hires
+// pixels: the first pixel of the first row to write
+// pitch: the distance between output rows in bytes
+void ExpandVideo(PackedVideo const& video, bool hires, void* pixels, int pitch);
+
+// Expand only the display rows whose bits are set in rowMask
+// the other output rows are left as they were
+void ExpandVideo(PackedVideo const& video, bool hires, uint64_t rowMask,
+    void* pixels, int pitch);
+
+// The output rows written for the display rows set in rowMask
+// which is where to upload the expanded pixels to
+uint64_t ExpandedRows(bool hires, uint64_t rowMask);
+
+#endif
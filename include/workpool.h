@@ -0,0 +1,75 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed number of worker threads sharing out short jobs by work stealing
+// Every worker has a queue of its own. It runs the jobs in its queue in
+// the order they were submitted, and once that is empty steals from the
+// back of another worker's queue, so a worker that was handed a lot of
+// work doesn't keep it to itself while the others sit idle.
+// Jobs are meant to be short: a long running task should do a slice of
+// its work and submit itself again, which puts it behind everything
+// already waiting, so one busy task can't starve the others.
+// Workers with nothing to do sleep until a job is submitted.
+class WorkPool
+{
+public:
+    using Job = std::function<void()>;
+
+    // count: the number of worker threads, at least 1
+    explicit WorkPool(size_t count);
+
+    // Finish every job submitted, then stop the workers
+    ~WorkPool();
+
+    WorkPool(WorkPool const&) = delete;
+    WorkPool& operator=(WorkPool const&) = delete;
+
+    // The number of worker threads
+    size_t Size() const;
+
+    // Queue a job, from any thread
+    // from a worker thread it goes on the back of that worker's own queue,
+    // from anywhere else on the queues in turn
+    void Submit(Job job);
+
+    // the number of jobs run so far
+    std::atomic<unsigned long> jobs{};
+    // the number of those that were stolen from another worker's queue
+    std::atomic<unsigned long> steals{};
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    void Work(size_t index);
+
+    // Take the next job for worker index, from its own queue or stolen
+    // returns false if every queue is empty
+    bool Take(size_t index, Job& job);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    // the queue the next job from outside the pool goes on
+    std::atomic<size_t> next{};
+
+    // jobs submitted but not yet taken, for deciding when to sleep
+    std::atomic<size_t> queued{};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping{};
+};
+
+#endif
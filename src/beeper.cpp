@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "beeper.h"
+
+Beeper::Beeper(unsigned int sampleRate, double frameRate, double latency)
+    : sampleRate(sampleRate)
+    , samplesPerFrame(sampleRate / frameRate)
+    , maxQueued(std::min<size_t>(std::max(latency, 0.0) * sampleRate, CAPACITY))
+{
+}
+
+void Beeper::Frame(bool on)
+{
+    // whole samples only, with the remainder made up in later frames
+    carry += samplesPerFrame;
+    size_t count = static_cast<size_t>(carry);
+    carry -= count;
+
+    int16_t samples[1024];
+    double step = frequency / sampleRate;
+
+    while (count)
+    {
+        size_t chunk = std::min(count, sizeof(samples) / sizeof(samples[0]));
+
+        for (size_t i = 0; i < chunk; ++i)
+        {
+            // the phase keeps running while silent, so the tone
+            // starts the same way whenever the timer is set
+            samples[i] = on ? (phase < 0.5 ? volume : -volume) : 0;
+            phase += step;
+            phase -= static_cast<int>(phase);
+        }
+
+        // keep no more than maxQueued samples waiting
+        size_t queued = ring.Size();
+        size_t room = queued < maxQueued ? maxQueued - queued : 0;
+        size_t written = ring.Push(samples, std::min(chunk, room));
+
+        overruns.fetch_add(chunk - written, std::memory_order_relaxed);
+        count -= chunk;
+    }
+}
+
+void Beeper::Fill(int16_t* samples, size_t count)
+{
+    size_t read = ring.Pop(samples, count);
+
+    if (read < count)
+    {
+        memset(samples + read, 0, (count - read) * sizeof(samples[0]));
+        underruns.fetch_add(count - read, std::memory_order_relaxed);
+    }
+}
+
+unsigned int Beeper::SampleRate() const
+{
+    return sampleRate;
+}
@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "blockcache.h"
+#include "chip8.h"
+
+// once this many instructions have been decoded the cache starts over
+// dropped blocks are never reused, so this bounds the garbage they leave
+const size_t MAX_CACHED_OPS = 0x4000;
+
+bool BlockCache::EndsBlock(Chip8::Handler handler)
+{
+    return handler == &Chip8::OP_00EE
+        || handler == &Chip8::OP_00FD
+        || handler == &Chip8::OP_1nnn
+        || handler == &Chip8::OP_2nnn
+        || handler == &Chip8::OP_3xkk
+        || handler == &Chip8::OP_4xkk
+        || handler == &Chip8::OP_5xy0
+        || handler == &Chip8::OP_9xy0
+        || handler == &Chip8::OP_Bnnn
+        || handler == &Chip8::OP_Ex9E
+        || handler == &Chip8::OP_ExA1
+        || handler == &Chip8::OP_Fx0A
+        || handler == &Chip8::OP_Fx33
+        || handler == &Chip8::OP_Fx55;
+}
+
+unsigned long BlockCache::Run(Chip8& chip8, unsigned long cycles)
+{
+    unsigned long executed = 0;
+
+    while (executed < cycles)
+    {
+        // drop anything the last block wrote over
+        if (chip8.writtenPages)
+        {
+            if (chip8.writtenPages & cachedPages)
+            {
+                Invalidate(chip8.writtenPages);
+            }
+
+            chip8.writtenPages = 0;
+        }
+
+        uint16_t pc = chip8.pc;
+
+        // an instruction has to fit in memory to be decoded
+        // leave anything at the very end to the interpreter
+        if (pc + 1u >= Memory::SIZE)
+        {
+            chip8.Cycle();
+            ++executed;
+            continue;
+        }
+
+        Block const& block = blockAt[pc] ? blocks[blockAt[pc] - 1] : Translate(chip8, pc);
+
+        // the block may be cut short by the end of the cycle budget
+        // which is fine because every instruction in it runs in order
+        unsigned long budget = cycles - executed;
+        unsigned long count = 0;
+        DecodedOp const* op = &ops[block.first];
+        DecodedOp const* end = op + block.size;
+
+        for (; op != end && count < budget; ++op)
+        {
+            // a pair that doesn't fit in the budget only runs its first half
+            if (op->fusion != Fusion::None && budget - count >= 2)
+            {
+                count += RunFused(chip8, *op);
+                continue;
+            }
+
+            // the same steps as Chip8::Cycle, minus fetching and decoding
+            chip8.opcode = op->opcode;
+            chip8.pc += 2;
+            (chip8.*(op->handler))();
+            ++count;
+        }
+
+        executed += count;
+    }
+
+    return executed;
+}
+
+void BlockCache::Flush()
+{
+    memset(blockAt, 0, sizeof(blockAt));
+    blocks.clear();
+    ops.clear();
+    cachedPages = 0;
+}
+
+void BlockCache::Prewarm(Chip8& chip8, RomAnalysis const& analysis)
+{
+    // loading the ROM marked its pages as written, which the first Run
+    // would otherwise take as the program writing over what was decoded here
+    if (chip8.writtenPages & cachedPages)
+    {
+        Invalidate(chip8.writtenPages);
+    }
+
+    chip8.writtenPages = 0;
+
+    for (RomAnalysis::Block const& block : analysis.blocks)
+    {
+        if (Full())
+        {
+            break;
+        }
+
+        if (!blockAt[block.start])
+        {
+            Translate(chip8, block.start);
+        }
+    }
+}
+
+bool BlockCache::Full() const
+{
+    return ops.size() + MAX_BLOCK_LENGTH > MAX_CACHED_OPS || blocks.size() >= 0xFFFF;
+}
+
+BlockCache::Block const& BlockCache::Translate(Chip8 const& chip8, uint16_t pc)
+{
+    // start over once the cache is full
+    // blockAt holds 16 bit indices, so the number of blocks is limited too
+    if (Full())
+    {
+        Flush();
+    }
+
+    Block block{};
+    block.start = pc;
+    block.first = ops.size();
+
+    uint16_t address = pc;
+
+    // decode until something that ends a block, the maximum length
+    // or the end of memory, whichever comes first
+    while (block.length < MAX_BLOCK_LENGTH && address + 1u < Memory::SIZE)
+    {
+        uint16_t opcode = (chip8.memory[address] << 8u) | chip8.memory[address + 1];
+        Chip8::Handler handler = chip8.Decode(opcode);
+        DecodedOp op{ handler, opcode, 0, Fusion::None };
+        bool ends = EndsBlock(handler);
+
+        ++block.length;
+        address += 2;
+
+        // take the next instruction along if the two make a pair
+        if (fuse && block.length < MAX_BLOCK_LENGTH && address + 1u < Memory::SIZE)
+        {
+            uint16_t second = (chip8.memory[address] << 8u) | chip8.memory[address + 1];
+            Fusion fusion = Pair(handler, second);
+
+            if (fusion != Fusion::None)
+            {
+                op.second = second;
+                op.fusion = fusion;
+                ends = ends || EndsBlock(chip8.Decode(second));
+
+                ++block.length;
+                ++fusions;
+                address += 2;
+            }
+        }
+
+        ops.push_back(op);
+        ++block.size;
+
+        if (ends)
+        {
+            break;
+        }
+    }
+
+    block.pages = Chip8::PageMask(pc, address - pc);
+    cachedPages |= block.pages;
+
+    blocks.push_back(block);
+    blockAt[pc] = blocks.size();
+    ++translations;
+
+    return blocks.back();
+}
+
+BlockCache::Fusion BlockCache::Pair(Chip8::Handler first, uint16_t second)
+{
+    Chip8::Handler next = Chip8::Decode(second);
+
+    if (first == &Chip8::OP_Annn && next == &Chip8::OP_Dxyn)
+    {
+        return Fusion::IndexDraw;
+    }
+
+    if (first == &Chip8::OP_Fx07 && next == &Chip8::OP_3xkk)
+    {
+        return Fusion::DelaySkip;
+    }
+
+    bool skips = first == &Chip8::OP_3xkk
+        || first == &Chip8::OP_4xkk
+        || first == &Chip8::OP_5xy0
+        || first == &Chip8::OP_9xy0
+        || first == &Chip8::OP_Ex9E
+        || first == &Chip8::OP_ExA1;
+
+    if (skips && next == &Chip8::OP_1nnn)
+    {
+        return Fusion::SkipJump;
+    }
+
+    return Fusion::None;
+}
+
+unsigned int BlockCache::RunFused(Chip8& chip8, DecodedOp const& op)
+{
+    switch (op.fusion)
+    {
+        case Fusion::IndexDraw:
+            // Annn only sets I, so the draw can start straight away
+            chip8.index = op.opcode & 0x0FFFu;
+            chip8.opcode = op.second;
+            chip8.pc += 4;
+            chip8.OP_Dxyn();
+            return 2;
+
+        case Fusion::DelaySkip:
+        {
+            // the register read may be VF, or the one the skip tests,
+            // so the timer is stored before the test reads anything
+            chip8.registers[(op.opcode & 0x0F00u) >> 8u] = chip8.delayTimer;
+            chip8.opcode = op.second;
+            chip8.pc += 4;
+
+            if (chip8.registers[(op.second & 0x0F00u) >> 8u] == (op.second & 0x00FFu))
+            {
+                chip8.pc += 2;
+            }
+
+            return 2;
+        }
+
+        case Fusion::SkipJump:
+        {
+            chip8.opcode = op.opcode;
+            chip8.pc += 2;
+
+            uint16_t jump = chip8.pc;
+            (chip8.*(op.handler))();
+
+            // skipping leaves the jump out
+            if (chip8.pc != jump)
+            {
+                return 1;
+            }
+
+            chip8.opcode = op.second;
+            chip8.pc = op.second & 0x0FFFu;
+            return 2;
+        }
+
+        default:
+            chip8.opcode = op.opcode;
+            chip8.pc += 2;
+            (chip8.*(op.handler))();
+            return 1;
+    }
+}
+
+void BlockCache::Invalidate(uint64_t pages)
+{
+    cachedPages = 0;
+
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        Block const& block = blocks[i];
+
+        // skip blocks that were already dropped
+        if (blockAt[block.start] != i + 1)
+        {
+            continue;
+        }
+
+        if (block.pages & pages)
+        {
+            blockAt[block.start] = 0;
+            ++invalidations;
+        }
+        else
+        {
+            cachedPages |= block.pages;
+        }
+    }
+}
@@ -1,15 +1,24 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
-#include <fstream>
 #include <chrono>
-#include <random>
+#include <type_traits>
+#include <utility>
 
 #include "chip8.h"
 #include "constants.h"
+#include "romimage.h"
+
+#ifdef CHIP8_PROFILE
+#include "profile.h"
+#endif
 
 // ROM DATA
-// the ROM is loaded into memory starting at memory address 0x200
-const unsigned int START_ADDRESS = 0x200;
+// the ROM is loaded into memory starting at Chip8::START_ADDRESS, 0x200
+static_assert(Chip8::START_ADDRESS + Chip8::MAX_ROM_SIZE == Memory::SIZE,
+    "a ROM can fill memory up to the end");
 // FONT DATA
 // the font is stored in a specific range of memory
 // it starts at address 0x50
@@ -38,26 +47,56 @@ uint8_t fontset[FONTSET_SIZE] =
     0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
+// the SUPER-CHIP big font, for Fx30
+// it follows the small font, and each character is 10 rows of 8 pixels
+const unsigned int BIG_FONTSET_START_ADDRESS = FONTSET_START_ADDRESS + FONTSET_SIZE;
+const unsigned int BIG_FONTSET_SIZE = 160;
+static_assert(BIG_FONTSET_START_ADDRESS + BIG_FONTSET_SIZE <= Chip8::START_ADDRESS,
+    "the fonts fit below the ROM");
+uint8_t bigFontset[BIG_FONTSET_SIZE] =
+{
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
 
+// FUNCTION TABLES
+// the tables are built by constexpr functions, so they are constant
+// initialized: they are part of the program image, and constructing
+// a machine doesn't have to fill them in
 
-Chip8::Chip8()
-    : randGen(std::chrono::system_clock::now().time_since_epoch().count())
+// every slot starts out as the null function
+// so that invalid opcodes are ignored rather than called through NULL
+template <size_t N>
+static constexpr std::array<Chip8::Handler, N> NullTable()
 {
-    // initialize the PC
-    // it must point to the starting range for the ROM memory space
-    // that is, 0x200
-    pc = START_ADDRESS;
+    std::array<Chip8::Handler, N> handlers{};
 
-    // load the font into memory
-    for(unsigned int i = 0; i < FONTSET_SIZE; ++i)
+    for (auto& handler : handlers)
     {
-        memory[FONTSET_START_ADDRESS + i] = fontset[i];
+        handler = &Chip8::OP_NULL;
     }
 
-    // the byte will be given a random int in the range [0,255]
-    randByte = std::uniform_int_distribution<uint8_t>(0, 255U);
+    return handlers;
+}
+
+static constexpr std::array<Chip8::Handler, 0xF + 1> MainTable()
+{
+    auto table = NullTable<0xF + 1>();
 
-    // fill the function pointer tables
     table[0x0] = &Chip8::Table0;
     table[0x1] = &Chip8::OP_1nnn;
     table[0x2] = &Chip8::OP_2nnn;
@@ -75,8 +114,39 @@ Chip8::Chip8()
     table[0xE] = &Chip8::TableE;
     table[0xF] = &Chip8::TableF;
 
-    table0[0x0] = &Chip8::OP_00E0;
-    table0[0xE] = &Chip8::OP_00EE;
+    return table;
+}
+
+static constexpr std::array<Chip8::Handler, 0xFF + 1> SubTable0()
+{
+    auto table0 = NullTable<0xFF + 1>();
+
+    // CLS and RET only ever looked at the last nibble,
+    // so they still cover every byte the newer opcodes don't
+    for (unsigned int low = 0; low <= 0xF0; low += 0x10)
+    {
+        table0[low | 0x0] = &Chip8::OP_00E0;
+        table0[low | 0xE] = &Chip8::OP_00EE;
+    }
+
+    for (unsigned int n = 0; n <= 0xF; ++n)
+    {
+        table0[0xC0 | n] = &Chip8::OP_00Cn;
+        table0[0xD0 | n] = &Chip8::OP_00Dn;
+    }
+
+    table0[0xFB] = &Chip8::OP_00FB;
+    table0[0xFC] = &Chip8::OP_00FC;
+    table0[0xFD] = &Chip8::OP_00FD;
+    table0[0xFE] = &Chip8::OP_00FE;
+    table0[0xFF] = &Chip8::OP_00FF;
+
+    return table0;
+}
+
+static constexpr std::array<Chip8::Handler, 0xF + 1> SubTable8()
+{
+    auto table8 = NullTable<0xF + 1>();
 
     table8[0x0] = &Chip8::OP_8xy0;
     table8[0x1] = &Chip8::OP_8xy1;
@@ -88,46 +158,216 @@ Chip8::Chip8()
     table8[0x7] = &Chip8::OP_8xy7;
     table8[0xE] = &Chip8::OP_8xyE;
 
+    return table8;
+}
+
+static constexpr std::array<Chip8::Handler, 0xF + 1> SubTableE()
+{
+    auto tableE = NullTable<0xF + 1>();
+
     tableE[0x1] = &Chip8::OP_ExA1;
     tableE[0xE] = &Chip8::OP_Ex9E;
 
+    return tableE;
+}
+
+static constexpr std::array<Chip8::Handler, 0xFF + 1> SubTableF()
+{
+    auto tableF = NullTable<0xFF + 1>();
+
+    tableF[0x01] = &Chip8::OP_Fn01;
     tableF[0x07] = &Chip8::OP_Fx07;
     tableF[0x0A] = &Chip8::OP_Fx0A;
     tableF[0x15] = &Chip8::OP_Fx15;
     tableF[0x18] = &Chip8::OP_Fx18;
     tableF[0x1E] = &Chip8::OP_Fx1E;
     tableF[0x29] = &Chip8::OP_Fx29;
+    tableF[0x30] = &Chip8::OP_Fx30;
     tableF[0x33] = &Chip8::OP_Fx33;
     tableF[0x55] = &Chip8::OP_Fx55;
     tableF[0x65] = &Chip8::OP_Fx65;
+    tableF[0x75] = &Chip8::OP_Fx75;
+    tableF[0x85] = &Chip8::OP_Fx85;
+
+    return tableF;
 }
 
-void Chip8::loadROM(char const* filename)
+constexpr std::array<Chip8::Handler, 0xF + 1> Chip8::table = MainTable();
+constexpr std::array<Chip8::Handler, 0xFF + 1> Chip8::table0 = SubTable0();
+constexpr std::array<Chip8::Handler, 0xF + 1> Chip8::table8 = SubTable8();
+constexpr std::array<Chip8::Handler, 0xF + 1> Chip8::tableE = SubTableE();
+constexpr std::array<Chip8::Handler, 0xFF + 1> Chip8::tableF = SubTableF();
+
+// walk the tables exactly like Cycle does
+// this is constexpr so the flat table can be resolved at compile time too
+static constexpr Chip8::Handler DecodeOpcode(uint16_t op)
 {
-    // open a filestream of the ROM binary and move the pointer to the end
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    Chip8::Handler handler = Chip8::table[(op & 0xF000u) >> 12u];
 
-    if (file.is_open())
+    // opcodes that share a first nibble are told apart by a sub table
+    if (handler == &Chip8::Table0)
+    {
+        handler = Chip8::table0[op & 0x00FFu];
+    }
+    else if (handler == &Chip8::Table8)
     {
-        // get file size, allocate buffer
-        std::streampos size = file.tellg();
-        char* buffer = new char[size];
+        handler = Chip8::table8[op & 0x000Fu];
+    }
+    else if (handler == &Chip8::TableE)
+    {
+        handler = Chip8::tableE[op & 0x000Fu];
+    }
+    else if (handler == &Chip8::TableF)
+    {
+        handler = Chip8::tableF[op & 0x00FFu];
+    }
+
+    return handler;
+}
+
+#ifdef CHIP8_DISPATCH_FLAT
+// the specialized handlers of every 8xy_ opcode with the same x and y
+// an 8xy_ opcode is looked up as specialized8[xy][_]
+template <unsigned int XY>
+static constexpr std::array<Chip8::Handler, 0xF + 1> Specialized8()
+{
+    constexpr unsigned int Vx = XY >> 4u;
+    constexpr unsigned int Vy = XY & 0xFu;
+
+    auto handlers = NullTable<0xF + 1>();
+
+    handlers[0x0] = &Chip8::OP_8xy0<Vx, Vy>;
+    handlers[0x1] = &Chip8::OP_8xy1<Vx, Vy>;
+    handlers[0x2] = &Chip8::OP_8xy2<Vx, Vy>;
+    handlers[0x3] = &Chip8::OP_8xy3<Vx, Vy>;
+    handlers[0x4] = &Chip8::OP_8xy4<Vx, Vy>;
+    handlers[0x5] = &Chip8::OP_8xy5<Vx, Vy>;
+    handlers[0x6] = &Chip8::OP_8xy6<Vx>;
+    handlers[0x7] = &Chip8::OP_8xy7<Vx, Vy>;
+    handlers[0xE] = &Chip8::OP_8xyE<Vx>;
+
+    return handlers;
+}
+
+template <unsigned int... XY>
+static constexpr std::array<std::array<Chip8::Handler, 0xF + 1>, 0xFF + 1>
+    Specialized8(std::integer_sequence<unsigned int, XY...>)
+{
+    return {{ Specialized8<XY>()... }};
+}
+
+// the specialized handlers of 6xkk and 7xkk, indexed by x
+template <unsigned int... Vx>
+static constexpr std::array<Chip8::Handler, 0xF + 1>
+    Specialized6(std::integer_sequence<unsigned int, Vx...>)
+{
+    return {{ &Chip8::OP_6xkk<Vx>... }};
+}
+
+template <unsigned int... Vx>
+static constexpr std::array<Chip8::Handler, 0xF + 1>
+    Specialized7(std::integer_sequence<unsigned int, Vx...>)
+{
+    return {{ &Chip8::OP_7xkk<Vx>... }};
+}
 
-        // fill the buffer
-        // first go to the befinning of the file
-        file.seekg(0, std::ios::beg);
-        file.read(buffer, size);
-        file.close();
+// resolve every opcode once, preferring a handler specialized on its
+// register fields wherever there is one, so those don't have to be
+// extracted from the opcode when it runs
+static constexpr std::array<Chip8::Handler, 0x10000> FlatTable()
+{
+    constexpr auto specialized6 = Specialized6(std::make_integer_sequence<unsigned int, 0xF + 1>());
+    constexpr auto specialized7 = Specialized7(std::make_integer_sequence<unsigned int, 0xF + 1>());
+    constexpr auto specialized8 = Specialized8(std::make_integer_sequence<unsigned int, 0xFF + 1>());
 
-        // load the ROM in the Chip8's mem, starting at 0x200
-        for(long i = 0; i < size; ++i)
+    std::array<Chip8::Handler, 0x10000> handlers{};
+
+    for (uint32_t op = 0; op < handlers.size(); ++op)
+    {
+        switch (op >> 12u)
         {
-            memory[START_ADDRESS + i] = buffer[i];
+            case 0x6:
+                handlers[op] = specialized6[(op & 0x0F00u) >> 8u];
+                break;
+            case 0x7:
+                handlers[op] = specialized7[(op & 0x0F00u) >> 8u];
+                break;
+            case 0x8:
+                handlers[op] = specialized8[(op & 0x0FF0u) >> 4u][op & 0x000Fu];
+                break;
+            default:
+                handlers[op] = DecodeOpcode(op);
+                break;
         }
+    }
+
+    return handlers;
+}
+
+constexpr std::array<Chip8::Handler, 0x10000> Chip8::flatTable = FlatTable();
+#endif
+
+// the registers an instruction works on have to share one cache line
+static_assert(offsetof(Chip8, soundTimer) < 64, "the CPU state does not fit in a cache line");
+
+
+Chip8::Chip8()
+{
+    // initialize the PC
+    // it must point to the starting range for the ROM memory space
+    // that is, 0x200
+    pc = START_ADDRESS;
+
+    // load the font into memory
+    // every machine starts out sharing one copy of it
+    static Memory const fontMemory = []()
+    {
+        Memory font;
+        font.Write(FONTSET_START_ADDRESS, fontset, FONTSET_SIZE);
+        font.Write(BIG_FONTSET_START_ADDRESS, bigFontset, BIG_FONTSET_SIZE);
+
+        return font;
+    }();
+
+    memory = fontMemory;
 
-        // delete the buffer
-        delete[] buffer;
+    // every run is different, unless a seed is given
+    rng.Seed(std::chrono::system_clock::now().time_since_epoch().count());
+}
+
+void Chip8::Seed(uint64_t seed)
+{
+    rng.Seed(seed);
+}
+
+Chip8::Handler Chip8::Decode(uint16_t op)
+{
+    return DecodeOpcode(op);
+}
+
+bool Chip8::loadROM(char const* filename)
+{
+    // map the file, so that it is copied once, straight into memory
+    RomImage image(filename);
+
+    return image.Loaded() && loadROM(image.Data(), image.Size());
+}
+
+bool Chip8::loadROM(uint8_t const* data, size_t size)
+{
+    // anything past the end of memory would be written out of bounds
+    if (size > MAX_ROM_SIZE)
+    {
+        return false;
     }
+
+    // load the ROM in the Chip8's mem, starting at 0x200
+    memory.Write(START_ADDRESS, data, size);
+
+    // anything that was cached from the old contents is now stale
+    writtenPages |= PageMask(START_ADDRESS, size);
+
+    return true;
 }
 
 
@@ -136,16 +376,135 @@ void Chip8::Cycle()
     // Fetch the next instruction from memory
     // each instruction is two bytes
     // and is stored in two consecutive bytes in memory
-    opcode = (memory[pc] << 8u) | memory[pc + 1];
+    opcode = memory.Word(pc);
+
+#ifdef CHIP8_PROFILE
+    // draws are timed, since they are the most expensive instruction
+    uint16_t address = pc;
+    bool timed = profile && (opcode & 0xF000u) == 0xD000u;
+    std::chrono::steady_clock::time_point start;
+
+    if (profile)
+    {
+        profile->Executed(address, opcode);
+    }
+
+    if (timed)
+    {
+        start = std::chrono::steady_clock::now();
+    }
+#endif
 
     // increment the PC to the next instruction
     pc += 2;
 
     // decode and execute
+#if defined(CHIP8_DISPATCH_FLAT)
+    // every opcode has its own slot, so this is a single indirect call
+    ((*this).*(flatTable[opcode]))();
+#elif defined(CHIP8_DISPATCH_SWITCH)
+    // the switch mirrors the tables, including which bits each level looks at
+    switch ((opcode & 0xF000u) >> 12u)
+    {
+        case 0x0:
+            switch (opcode & 0x00FFu)
+            {
+                case 0xFB: OP_00FB(); break;
+                case 0xFC: OP_00FC(); break;
+                case 0xFD: OP_00FD(); break;
+                case 0xFE: OP_00FE(); break;
+                case 0xFF: OP_00FF(); break;
+                default:
+                    switch (opcode & 0x00F0u)
+                    {
+                        case 0xC0: OP_00Cn(); break;
+                        case 0xD0: OP_00Dn(); break;
+                        default:
+                            switch (opcode & 0x000Fu)
+                            {
+                                case 0x0: OP_00E0(); break;
+                                case 0xE: OP_00EE(); break;
+                            }
+                            break;
+                    }
+                    break;
+            }
+            break;
+        case 0x1: OP_1nnn(); break;
+        case 0x2: OP_2nnn(); break;
+        case 0x3: OP_3xkk(); break;
+        case 0x4: OP_4xkk(); break;
+        case 0x5: OP_5xy0(); break;
+        case 0x6: OP_6xkk(); break;
+        case 0x7: OP_7xkk(); break;
+        case 0x8:
+            switch (opcode & 0x000Fu)
+            {
+                case 0x0: OP_8xy0(); break;
+                case 0x1: OP_8xy1(); break;
+                case 0x2: OP_8xy2(); break;
+                case 0x3: OP_8xy3(); break;
+                case 0x4: OP_8xy4(); break;
+                case 0x5: OP_8xy5(); break;
+                case 0x6: OP_8xy6(); break;
+                case 0x7: OP_8xy7(); break;
+                case 0xE: OP_8xyE(); break;
+            }
+            break;
+        case 0x9: OP_9xy0(); break;
+        case 0xA: OP_Annn(); break;
+        case 0xB: OP_Bnnn(); break;
+        case 0xC: OP_Cxkk(); break;
+        case 0xD: OP_Dxyn(); break;
+        case 0xE:
+            switch (opcode & 0x000Fu)
+            {
+                case 0x1: OP_ExA1(); break;
+                case 0xE: OP_Ex9E(); break;
+            }
+            break;
+        case 0xF:
+            switch (opcode & 0x00FFu)
+            {
+                case 0x01: OP_Fn01(); break;
+                case 0x07: OP_Fx07(); break;
+                case 0x0A: OP_Fx0A(); break;
+                case 0x15: OP_Fx15(); break;
+                case 0x18: OP_Fx18(); break;
+                case 0x1E: OP_Fx1E(); break;
+                case 0x29: OP_Fx29(); break;
+                case 0x30: OP_Fx30(); break;
+                case 0x33: OP_Fx33(); break;
+                case 0x55: OP_Fx55(); break;
+                case 0x65: OP_Fx65(); break;
+                case 0x75: OP_Fx75(); break;
+                case 0x85: OP_Fx85(); break;
+            }
+            break;
+    }
+#else
     // this is done by indexing the opcode function table
     // with the opcode's first nibble
     ((*this).*(table[(opcode & 0xF000u) >> 12u]))();
+#endif
+
+#ifdef CHIP8_PROFILE
+    if (timed)
+    {
+        profile->drawNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
 
+    // OP_Fx0A moves the pc back onto itself until a key is pressed
+    if (profile && (opcode & 0xF0FFu) == 0xF00Au && pc == address)
+    {
+        ++profile->keyWaits;
+    }
+#endif
+}
+
+void Chip8::TickTimers()
+{
     // decrement the delay timer if set
     if (delayTimer > 0)
     {
@@ -160,12 +519,215 @@ void Chip8::Cycle()
 }
 
 
+bool Chip8::SkipIdle(unsigned long cycles)
+{
+    if (cycles == 0)
+    {
+        return false;
+    }
+
+    uint16_t current = memory.Word(pc);
+
+    // Fx0A waiting for a key, a jump to itself, or 00FD
+    // all leave everything as it is, apart from the opcode
+    bool keyPressed = false;
+
+    for (uint8_t key : keypad)
+    {
+        keyPressed |= key != 0;
+    }
+
+    if (((current & 0xF0FFu) == 0xF00Au && !keyPressed)
+        || current == (0x1000u | pc)
+        || (current & 0xF0FFu) == 0x00FDu)
+    {
+        opcode = current;
+        return true;
+    }
+
+    // Fx07, 3xkk, 1nnn back to the Fx07, with the pc on any of the three
+    for (unsigned int position = 0; position < 3; ++position)
+    {
+        unsigned int start = pc - 2 * position;
+
+        if (pc < 2 * position || start + 6 > Memory::SIZE)
+        {
+            continue;
+        }
+
+        uint16_t load = memory.Word(start);
+        uint16_t skip = memory.Word(start + 2);
+        uint16_t jump = memory.Word(start + 4);
+        uint8_t Vx = (load & 0x0F00u) >> 8u;
+        uint8_t kk = skip & 0x00FFu;
+
+        if ((load & 0xF0FFu) != 0xF007u
+            || (skip & 0xFF00u) != (0x3000u | (Vx << 8u))
+            || jump != (0x1000u | start))
+        {
+            continue;
+        }
+
+        // the loop is left once Vx is kk, which it only becomes
+        // with a delay timer of kk
+        // starting on the 3xkk, Vx still has whatever it had before
+        if (delayTimer == kk || (position == 1 && registers[Vx] == kk))
+        {
+            return false;
+        }
+
+        // the Fx07 is the (3 - position) % 3th instruction executed
+        if (cycles > (3 - position) % 3)
+        {
+            registers[Vx] = delayTimer;
+        }
+
+        uint16_t const loop[3] = { load, skip, jump };
+
+        opcode = loop[(position + cycles - 1) % 3];
+        pc = start + 2 * ((position + cycles) % 3);
+
+        return true;
+    }
+
+    return false;
+}
+
+uint64_t Chip8::PageMask(unsigned int address, unsigned int size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    // memory wraps around, so anything written past the end
+    // continues from address 0
+    address &= Memory::SIZE - 1;
+
+    if (size >= Memory::SIZE)
+    {
+        return ~0ull;
+    }
+
+    if (address + size > Memory::SIZE)
+    {
+        unsigned int wrapped = address + size - Memory::SIZE;
+
+        return PageMask(address, size - wrapped) | PageMask(0, wrapped);
+    }
+
+    // pages are 64 bytes, so there are exactly 64 of them in 4K of memory
+    unsigned int first = address >> 6u;
+    unsigned int last = (address + size - 1) >> 6u;
+
+    // set bits [first, last]
+    uint64_t upToLast = last == 63u ? ~0ull : (1ull << (last + 1)) - 1;
+    return upToLast & ~((1ull << first) - 1);
+}
+
+// a savestate has to survive being copied around as plain bytes
+static_assert(std::is_trivially_copyable<Chip8State>::value,
+    "Chip8State must be trivially copyable");
+
+void Chip8::SaveState(Chip8State& state) const
+{
+    state.magic = Chip8State::MAGIC;
+    state.version = Chip8State::VERSION;
+    state.size = sizeof(Chip8State);
+
+    memcpy(state.video, video, sizeof(video));
+    memory.Read(0, state.memory, sizeof(state.memory));
+    memcpy(state.stack, stack, sizeof(stack));
+    state.index = index;
+    state.pc = pc;
+    memcpy(state.registers, registers, sizeof(registers));
+    memcpy(state.keypad, keypad, sizeof(keypad));
+    state.sp = sp;
+    state.delayTimer = delayTimer;
+    state.soundTimer = soundTimer;
+    state.rng = rng;
+    memcpy(state.flags, flags, sizeof(flags));
+    state.hires = hires;
+    state.planes = planes;
+}
+
+bool Chip8::LoadState(Chip8State const& state)
+{
+    if (state.magic != Chip8State::MAGIC
+        || state.version != Chip8State::VERSION
+        || state.size != sizeof(Chip8State))
+    {
+        return false;
+    }
+
+    memcpy(video, state.video, sizeof(video));
+    memory.Write(0, state.memory, sizeof(state.memory));
+    memcpy(stack, state.stack, sizeof(stack));
+    index = state.index;
+    pc = state.pc;
+    memcpy(registers, state.registers, sizeof(registers));
+    memcpy(keypad, state.keypad, sizeof(keypad));
+    sp = state.sp;
+    delayTimer = state.delayTimer;
+    soundTimer = state.soundTimer;
+    rng = state.rng;
+    memcpy(flags, state.flags, sizeof(flags));
+    hires = state.hires;
+    planes = state.planes;
+
+    // all of memory and the display may have changed
+    writtenPages = ~0ull;
+    dirtyRows = ~0ull;
+
+    return true;
+}
+
+// FNV-1a over a block of bytes, continuing from a previous hash value
+static uint64_t HashBytes(uint64_t hash, void const* data, size_t size)
+{
+    uint8_t const* bytes = static_cast<uint8_t const*>(data);
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+
+    return hash;
+}
+
+uint64_t Chip8::Hash() const
+{
+    // start from the FNV offset basis
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    hash = HashBytes(hash, registers, sizeof(registers));
+    for (unsigned int page = 0; page < Memory::PAGES; ++page)
+    {
+        hash = HashBytes(hash, memory.Page(page), Memory::PAGE_SIZE);
+    }
+
+    hash = HashBytes(hash, &index, sizeof(index));
+    hash = HashBytes(hash, &pc, sizeof(pc));
+    hash = HashBytes(hash, stack, sizeof(stack));
+    hash = HashBytes(hash, &sp, sizeof(sp));
+    hash = HashBytes(hash, &delayTimer, sizeof(delayTimer));
+    hash = HashBytes(hash, &soundTimer, sizeof(soundTimer));
+    hash = HashBytes(hash, video, sizeof(video));
+    hash = HashBytes(hash, &hires, sizeof(hires));
+    hash = HashBytes(hash, &planes, sizeof(planes));
+    hash = HashBytes(hash, flags, sizeof(flags));
+
+    return hash;
+}
+
+
 // TABLE FUNCTIONS
 void Chip8::Table0()
 {
-    // all opcodes executed by Table0 begin with 00E
-    // so the final nibble is used to determine the opcode to execute
-    ((*this).*(table0[opcode & 0x000Fu]))();
+    // all opcodes executed by Table0 begin with 00
+    // so the final byte is used to determine the opcode to execute
+    ((*this).*(table0[opcode & 0x00FFu]))();
 }
 
 void Chip8::Table8()
@@ -194,10 +756,23 @@ void Chip8::TableF()
 
 // OPCODE DEFINITIONS
 
+void Chip8::OP_NULL()
+{
+    // invalid opcodes do nothing
+}
+
 void Chip8::OP_00E0()
 {
-    // memset will fill the video memory with 0s
-    memset(video, 0, sizeof(video));
+    // memset will fill the video memory of every selected plane with 0s
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+    {
+        if (planes & (1u << plane))
+        {
+            memset(video[plane], 0, sizeof(video[plane]));
+        }
+    }
+
+    dirtyRows = ~0ull;
 }
 
 void Chip8::OP_00EE()
@@ -206,7 +781,128 @@ void Chip8::OP_00EE()
     // PC pushed onto it
     --sp;
     // set the PC to the old PC now stored on the stack top
-    pc = stack[sp];
+    // the stack is a ring of 16, so a return with nothing on it
+    // reads the oldest entry instead of going off the end
+    pc = stack[sp & 0xFu];
+}
+
+void Chip8::OP_00Cn()
+{
+    // scroll the selected planes down n rows
+    unsigned int height = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+    unsigned int n = std::min<unsigned int>(opcode & 0x000Fu, height);
+
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+    {
+        if (planes & (1u << plane))
+        {
+            // the rows that fall off the bottom are lost,
+            // and blank ones come in at the top
+            memmove(video[plane][n], video[plane][0], (height - n) * sizeof(video[plane][0]));
+            memset(video[plane][0], 0, n * sizeof(video[plane][0]));
+        }
+    }
+
+    dirtyRows = ~0ull;
+}
+
+void Chip8::OP_00Dn()
+{
+    // scroll the selected planes up n rows
+    unsigned int height = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+    unsigned int n = std::min<unsigned int>(opcode & 0x000Fu, height);
+
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+    {
+        if (planes & (1u << plane))
+        {
+            memmove(video[plane][0], video[plane][n], (height - n) * sizeof(video[plane][0]));
+            memset(video[plane][height - n], 0, n * sizeof(video[plane][0]));
+        }
+    }
+
+    dirtyRows = ~0ull;
+}
+
+void Chip8::OP_00FB()
+{
+    // scroll the selected planes right 4 pixels
+    unsigned int height = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+    {
+        if (!(planes & (1u << plane)))
+        {
+            continue;
+        }
+
+        for (unsigned int row = 0; row < height; ++row)
+        {
+            uint64_t* screenRow = video[plane][row];
+
+            // the pixels shifted out of the first word go into the second,
+            // which only holds anything at high resolution
+            if (hires)
+            {
+                screenRow[1] = (screenRow[1] >> 4) | (screenRow[0] << 60);
+            }
+
+            screenRow[0] >>= 4;
+        }
+    }
+
+    dirtyRows = ~0ull;
+}
+
+void Chip8::OP_00FC()
+{
+    // scroll the selected planes left 4 pixels
+    unsigned int height = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+    {
+        if (!(planes & (1u << plane)))
+        {
+            continue;
+        }
+
+        for (unsigned int row = 0; row < height; ++row)
+        {
+            uint64_t* screenRow = video[plane][row];
+
+            screenRow[0] <<= 4;
+
+            if (hires)
+            {
+                screenRow[0] |= screenRow[1] >> 60;
+                screenRow[1] <<= 4;
+            }
+        }
+    }
+
+    dirtyRows = ~0ull;
+}
+
+void Chip8::OP_00FD()
+{
+    // there's no host to go back to, so exiting stops the machine here
+    // by running this instruction forever
+    pc -= 2;
+}
+
+void Chip8::OP_00FE()
+{
+    // switching resolution clears the screen
+    hires = false;
+    memset(video, 0, sizeof(video));
+    dirtyRows = ~0ull;
+}
+
+void Chip8::OP_00FF()
+{
+    hires = true;
+    memset(video, 0, sizeof(video));
+    dirtyRows = ~0ull;
 }
 
 void Chip8::OP_1nnn()
@@ -228,7 +924,10 @@ void Chip8::OP_2nnn()
 
     // unlike jump, calling a subrouting stores the current PC value on the stack
     // push the current PC onto the stack, and increment the stack pointer
-    stack[pc] = pc; 
+    // a 17th nested call overwrites the oldest entry, like a ring,
+    // rather than the registers after the stack
+    // sp still counts every call, and wraps at 256, a multiple of 16
+    stack[sp & 0xFu] = pc;
     ++sp;
     pc = address;
 }
@@ -444,6 +1143,84 @@ void Chip8::OP_8xyE()
     registers[Vx] <<= 1;
 }
 
+#ifdef CHIP8_DISPATCH_FLAT
+// the specialized forms of 6xkk, 7xkk and 8xy_
+// the flag is written in the same order as above, so x or y being F
+// gives the same results
+template <unsigned int Vx>
+void Chip8::OP_6xkk()
+{
+    registers[Vx] = opcode & 0x00FFu;
+}
+
+template <unsigned int Vx>
+void Chip8::OP_7xkk()
+{
+    registers[Vx] += opcode & 0x00FFu;
+}
+
+template <unsigned int Vx, unsigned int Vy>
+void Chip8::OP_8xy0()
+{
+    registers[Vx] = registers[Vy];
+}
+
+template <unsigned int Vx, unsigned int Vy>
+void Chip8::OP_8xy1()
+{
+    registers[Vx] |= registers[Vy];
+}
+
+template <unsigned int Vx, unsigned int Vy>
+void Chip8::OP_8xy2()
+{
+    registers[Vx] &= registers[Vy];
+}
+
+template <unsigned int Vx, unsigned int Vy>
+void Chip8::OP_8xy3()
+{
+    registers[Vx] ^= registers[Vy];
+}
+
+template <unsigned int Vx, unsigned int Vy>
+void Chip8::OP_8xy4()
+{
+    uint16_t sum = registers[Vx] + registers[Vy];
+
+    registers[0xF] = sum > 255u;
+    registers[Vx] = sum & 0xFFu;
+}
+
+template <unsigned int Vx, unsigned int Vy>
+void Chip8::OP_8xy5()
+{
+    registers[0xF] = registers[Vx] > registers[Vy];
+    registers[Vx] -= registers[Vy];
+}
+
+template <unsigned int Vx>
+void Chip8::OP_8xy6()
+{
+    registers[0xF] = registers[Vx] & 0x1u;
+    registers[Vx] >>= 1;
+}
+
+template <unsigned int Vx, unsigned int Vy>
+void Chip8::OP_8xy7()
+{
+    registers[0xF] = registers[Vy] > registers[Vx];
+    registers[Vx] = registers[Vy] - registers[Vx];
+}
+
+template <unsigned int Vx>
+void Chip8::OP_8xyE()
+{
+    registers[0xF] = registers[Vx] & 0x80u;
+    registers[Vx] <<= 1;
+}
+#endif
+
 void Chip8::OP_9xy0()
 {
     // get Vx
@@ -484,7 +1261,7 @@ void Chip8::OP_Cxkk()
     uint8_t kk = opcode & 0x00FFu;
 
     // set Vx to a random byte of max size kk
-    registers[Vx] = randByte(randGen) & kk;
+    registers[Vx] = rng.Byte() & kk;
 }
 
 void Chip8::OP_Dxyn()
@@ -497,52 +1274,89 @@ void Chip8::OP_Dxyn()
     // The final nibble is the height
     uint8_t n = opcode & 0x000Fu;
 
-    // we wrap the sprite if it extends beyond the screen boundaries
-    uint8_t xPos = registers[Vx] % VIDEO_WIDTH;
-    uint8_t yPos = registers[Vy] % VIDEO_HEIGHT;
+    // Dxy0 draws a 16x16 sprite, stored as two bytes a row
+    unsigned int width = n ? 8 : 16;
+    unsigned int height = n ? n : 16;
+    unsigned int screenWidth = hires ? HIRES_WIDTH : VIDEO_WIDTH;
+    unsigned int screenHeight = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+
+    // the starting position wraps around the screen boundaries
+    unsigned int xPos = registers[Vx] % screenWidth;
+    unsigned int yPos = registers[Vy] % screenHeight;
 
     // by default, set the collision register to 0
     registers[0xF] = 0;
 
-    for (unsigned int row = 0; row < n; ++row)
-    {
-        // grab the current byte from memory
-        // we start at the position in memory pointed to by the I register
-        // offset by the current row
-        uint8_t spriteByte = memory[index + row];
-        
-        // now we iterate over the sprite byte
-        // in chip 8, all sprites are 8 pixels wide
-        // which is why they fit in a single byte
-        for (unsigned int col = 0; col < 8; ++col)
+    // every selected plane gets its own sprite,
+    // each one straight after the last in memory
+    uint16_t address = index;
+
+    for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+    {
+        if (!(planes & (1u << plane)))
         {
-            // isolate the pixel for the current row and column
-            // note how we do this by shifting the masking constant
-            // NOT the sprite byte
-            uint8_t spritePixel = spriteByte & (0x80u >> col);
-            // calculate the screen pixel we will display the sprite pixel on
-            // NOTE: the screen pixel is a pointer, hence the dereference operator
-            uint32_t* screenPixel = &video[(xPos + col) + (yPos + row) * VIDEO_WIDTH];
-            
-            // if the sprite pixel is to be turned on,
-            // we need to turn it off
-            // we may need to set the collision register
-            if (spritePixel)
+            continue;
+        }
+
+        for (unsigned int row = 0; row < height; ++row)
+        {
+            // sprites that run off the bottom of the screen are clipped
+            if (yPos + row >= screenHeight)
+            {
+                break;
+            }
+
+            // grab the current row of the sprite from memory
+            // we start at the position in memory pointed to by the I register
+            // offset by the current row
+            uint64_t spriteBits = width == 8
+                ? memory[address + row]
+                : (memory[address + 2 * row] << 8) | memory[address + 2 * row + 1];
+
+            // move the sprite row to the left edge of a screen row
+            // then shift it into place, which clips anything past the right edge
+            uint64_t sprite = spriteBits << (64 - width);
+            uint64_t* screenRow = video[plane][yPos + row];
+            uint64_t left;
+            uint64_t right;
+
+            if (!hires)
             {
-                // check if the screen pixel is on or off
-                // remember that we use 0xFFFFFFFF for on, and 0x00000000 for off
-                // this is to simplify working with SDL, the rendering API
-                if (*screenPixel == 0xFFFFFFFF)
-                {
-                    // if there is a pixel, then we have a collision
-                    // and we should set the collision bit to 1
-                    registers[0xF] = 1;
-                }
-
-                // toggle the sprite pixel with XOR
-                *screenPixel ^= 0xFFFFFFFF;
+                // a low resolution row fits in the first word
+                left = sprite >> xPos;
+                right = 0;
+            }
+            else if (xPos < 64)
+            {
+                left = sprite >> xPos;
+                right = xPos ? sprite << (64 - xPos) : 0;
+            }
+            else
+            {
+                left = 0;
+                right = sprite >> (xPos - 64);
+            }
+
+            // if any sprite pixel lands on a pixel that is already on
+            // then we have a collision
+            // and we should set the collision bit to 1
+            if ((screenRow[0] & left) | (screenRow[1] & right))
+            {
+                registers[0xF] = 1;
+            }
+
+            // toggle the sprite pixels with XOR
+            screenRow[0] ^= left;
+            screenRow[1] ^= right;
+
+            // a sprite row that is all 0s leaves the screen as it was
+            if (left | right)
+            {
+                dirtyRows |= 1ull << (yPos + row);
             }
         }
+
+        address += height * width / 8;
     }
 }
 
@@ -552,7 +1366,8 @@ void Chip8::OP_Ex9E()
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     // get the value of Vx
     // this will be used to index the keypad
-    uint8_t key = registers[Vx];
+    // only the low nibble names a key, there are just 16 of them
+    uint8_t key = registers[Vx] & 0xFu;
 
     // check the keypad
     // the corresponding key should be pressed
@@ -568,7 +1383,8 @@ void Chip8::OP_ExA1()
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     // get the value of Vx
     // this will be used to index the keypad
-    uint8_t key = registers[Vx];
+    // only the low nibble names a key, there are just 16 of them
+    uint8_t key = registers[Vx] & 0xFu;
 
     // check the keypad
     // the corresponding key should NOT be pressed
@@ -578,6 +1394,13 @@ void Chip8::OP_ExA1()
     }
 }
 
+void Chip8::OP_Fn01()
+{
+    // select the planes that drawing, clearing and scrolling work on
+    // there are only two, so the top bits of n are ignored
+    planes = ((opcode & 0x0F00u) >> 8u) & 0x3u;
+}
+
 void Chip8::OP_Fx07()
 {
     // get Vx
@@ -701,6 +1524,16 @@ void Chip8::OP_Fx29()
     index = FONTSET_START_ADDRESS + (5 * digit);
 }
 
+void Chip8::OP_Fx30()
+{
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+    uint8_t digit = registers[Vx] & 0xFu;
+
+    // the big digits sit right after the small ones,
+    // and each one is 10 bytes
+    index = BIG_FONTSET_START_ADDRESS + (10 * digit);
+}
+
 void Chip8::OP_Fx33()
 {
     // this stores a BCD (Binary Coded Decimal) representation in memory
@@ -716,15 +1549,17 @@ void Chip8::OP_Fx33()
     // with the 100s going to I, 10s to I+1, and 1s to I+1
 
     // get the 1s place
-    memory[index + 2] = value % 10;
+    memory.Write(index + 2, value % 10);
     // dividing by ten is a quick way to remove the least sig digit
     value /= 10;
 
     // 10s place
-    memory[index + 1] = value % 10;
+    memory.Write(index + 1, value % 10);
 
     // 100s place
-    memory[index] = value % 10;
+    memory.Write(index, value % 10);
+
+    writtenPages |= PageMask(index, 3);
 }
 
 void Chip8::OP_Fx55()
@@ -733,8 +1568,10 @@ void Chip8::OP_Fx55()
 
     for (uint8_t i = 0; i <= Vx; ++i)
     {
-        memory[index + i] = registers[i];
+        memory.Write(index + i, registers[i]);
     }
+
+    writtenPages |= PageMask(index, Vx + 1);
 }
 
 void Chip8::OP_Fx65()
@@ -745,4 +1582,26 @@ void Chip8::OP_Fx65()
     {
         registers[i] = memory[index + i];
     }
-}
\ No newline at end of file
+}
+
+void Chip8::OP_Fx75()
+{
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+
+    // the flags stand in for the HP48 calculator registers that
+    // outlived a program, which games used to keep high scores
+    for (uint8_t i = 0; i <= Vx; ++i)
+    {
+        flags[i] = registers[i];
+    }
+}
+
+void Chip8::OP_Fx85()
+{
+    uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+
+    for (uint8_t i = 0; i <= Vx; ++i)
+    {
+        registers[i] = flags[i];
+    }
+}
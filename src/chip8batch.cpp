@@ -0,0 +1,355 @@
+#include <cstddef>
+#include <cstdint>
+
+#include "chip8.h"
+#include "chip8batch.h"
+#include "romimage.h"
+
+// a if on is 1, b if on is 0, without branching
+template <typename T>
+static inline T Pick(uint8_t on, unsigned int a, T b)
+{
+    T mask = -static_cast<T>(on);
+
+    return b ^ ((static_cast<T>(a) ^ b) & mask);
+}
+
+Chip8Batch::Chip8Batch(size_t lanes)
+    : lanes(lanes)
+    , pc(lanes)
+    , index(lanes)
+    , delayTimer(lanes)
+    , soundTimer(lanes)
+    , machines(lanes)
+    , opcodes(lanes)
+    , pending(lanes)
+    , active(lanes)
+{
+    for (auto& lane : registers)
+    {
+        lane.resize(lanes);
+    }
+
+    // start every lane off from its newly constructed machine
+    for (size_t lane = 0; lane < lanes; ++lane)
+    {
+        Reload(lane);
+    }
+}
+
+size_t Chip8Batch::Lanes() const
+{
+    return lanes;
+}
+
+bool Chip8Batch::LoadROM(char const* filename)
+{
+    RomImage image(filename);
+
+    return image.Loaded() && LoadROM(image.Data(), image.Size());
+}
+
+bool Chip8Batch::LoadROM(uint8_t const* data, size_t size)
+{
+    if (size > Chip8::MAX_ROM_SIZE)
+    {
+        return false;
+    }
+
+    machines[0].loadROM(data, size);
+
+    // copy the memory of the first lane instead of loading the ROM again
+    // with CHIP8_SHARED_MEMORY, this has every lane share the same pages
+    for (size_t lane = 1; lane < lanes; ++lane)
+    {
+        machines[lane].memory = machines[0].memory;
+        machines[lane].writtenPages |= machines[0].writtenPages;
+    }
+
+    return true;
+}
+
+void Chip8Batch::Run(unsigned long cycles)
+{
+    for (unsigned long i = 0; i < cycles; ++i)
+    {
+        Step();
+    }
+}
+
+void Chip8Batch::TickTimers()
+{
+    uint8_t* delay = delayTimer.data();
+    uint8_t* sound = soundTimer.data();
+
+    for (size_t lane = 0; lane < lanes; ++lane)
+    {
+        delay[lane] -= delay[lane] > 0;
+        sound[lane] -= sound[lane] > 0;
+    }
+}
+
+Chip8& Chip8Batch::Machine(size_t lane)
+{
+    Chip8& machine = machines[lane];
+
+    for (unsigned int x = 0; x < 16; ++x)
+    {
+        machine.registers[x] = registers[x][lane];
+    }
+
+    machine.pc = pc[lane];
+    machine.index = index[lane];
+    machine.delayTimer = delayTimer[lane];
+    machine.soundTimer = soundTimer[lane];
+
+    return machine;
+}
+
+void Chip8Batch::Reload(size_t lane)
+{
+    Chip8 const& machine = machines[lane];
+
+    for (unsigned int x = 0; x < 16; ++x)
+    {
+        registers[x][lane] = machine.registers[x];
+    }
+
+    pc[lane] = machine.pc;
+    index[lane] = machine.index;
+    delayTimer[lane] = machine.delayTimer;
+    soundTimer[lane] = machine.soundTimer;
+}
+
+void Chip8Batch::Step()
+{
+    // fetch every lane's next instruction
+    for (size_t lane = 0; lane < lanes; ++lane)
+    {
+        Memory const& memory = machines[lane].memory;
+        uint16_t address = pc[lane];
+
+        // an instruction at the very end of memory is left to the interpreter
+        if (address + 1u >= Memory::SIZE)
+        {
+            StepLane(lane);
+            pending[lane] = 0;
+            continue;
+        }
+
+        opcodes[lane] = (memory[address] << 8u) | memory[address + 1];
+        pending[lane] = 1;
+    }
+
+    // the first lane still waiting to execute leads a group of
+    // every waiting lane at the same pc with the same opcode
+    size_t leader = 0;
+
+    for (unsigned int group = 0; group < MAX_GROUPS; ++group)
+    {
+        while (leader < lanes && !pending[leader])
+        {
+            ++leader;
+        }
+
+        if (leader == lanes)
+        {
+            return;
+        }
+
+        uint16_t address = pc[leader];
+        uint16_t opcode = opcodes[leader];
+        size_t count = 0;
+
+        for (size_t lane = 0; lane < lanes; ++lane)
+        {
+            active[lane] = pending[lane] & (pc[lane] == address) & (opcodes[lane] == opcode);
+            count += active[lane];
+        }
+
+        if (count > 1 && StepLanes(opcode))
+        {
+            vectorInstructions += count;
+
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                pending[lane] &= !active[lane];
+            }
+        }
+        else
+        {
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                if (active[lane])
+                {
+                    StepLane(lane);
+                    pending[lane] = 0;
+                }
+            }
+        }
+    }
+
+    // whatever didn't make it into a group goes one lane at a time
+    for (size_t lane = leader; lane < lanes; ++lane)
+    {
+        if (pending[lane])
+        {
+            StepLane(lane);
+        }
+    }
+}
+
+bool Chip8Batch::StepLanes(uint16_t opcode)
+{
+    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t y = (opcode & 0x00F0u) >> 4u;
+    uint8_t kk = opcode & 0x00FFu;
+    uint16_t nnn = opcode & 0x0FFFu;
+
+    // every loop below writes every lane, keeping the old value in the
+    // lanes that aren't active, so that they can be vectorized
+    // Vx and Vy are the same array when x == y, and either may be VF,
+    // so each lane reads and writes them in the same order as the opcode
+    // functions do
+    uint8_t const* on = active.data();
+    uint8_t* Vx = registers[x].data();
+    uint8_t* Vy = registers[y].data();
+    uint8_t* VF = registers[0xF].data();
+    uint16_t* PC = pc.data();
+    size_t n = lanes;
+
+    switch (opcode >> 12u)
+    {
+        case 0x1:
+            for (size_t i = 0; i < n; ++i) PC[i] = Pick(on[i], nnn, PC[i]);
+            return true;
+
+        // the skips step over the next instruction when their test passes
+        case 0x3:
+            for (size_t i = 0; i < n; ++i) PC[i] += on[i] * (2 + 2 * (Vx[i] == kk));
+            return true;
+
+        case 0x4:
+            for (size_t i = 0; i < n; ++i) PC[i] += on[i] * (2 + 2 * (Vx[i] != kk));
+            return true;
+
+        case 0x5:
+            for (size_t i = 0; i < n; ++i) PC[i] += on[i] * (2 + 2 * (Vx[i] == Vy[i]));
+            return true;
+
+        case 0x9:
+            for (size_t i = 0; i < n; ++i) PC[i] += on[i] * (2 + 2 * (Vx[i] != Vy[i]));
+            return true;
+
+        case 0x6:
+            for (size_t i = 0; i < n; ++i) Vx[i] = Pick(on[i], kk, Vx[i]);
+            break;
+
+        case 0x7:
+            for (size_t i = 0; i < n; ++i) Vx[i] += on[i] * kk;
+            break;
+
+        case 0x8:
+            switch (opcode & 0x000Fu)
+            {
+                case 0x0:
+                    for (size_t i = 0; i < n; ++i) Vx[i] = Pick(on[i], Vy[i], Vx[i]);
+                    break;
+                case 0x1:
+                    for (size_t i = 0; i < n; ++i) Vx[i] = Pick(on[i], Vx[i] | Vy[i], Vx[i]);
+                    break;
+                case 0x2:
+                    for (size_t i = 0; i < n; ++i) Vx[i] = Pick(on[i], Vx[i] & Vy[i], Vx[i]);
+                    break;
+                case 0x3:
+                    for (size_t i = 0; i < n; ++i) Vx[i] = Pick(on[i], Vx[i] ^ Vy[i], Vx[i]);
+                    break;
+                case 0x4:
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        uint16_t sum = Vx[i] + Vy[i];
+                        VF[i] = Pick(on[i], sum > 255u, VF[i]);
+                        Vx[i] = Pick(on[i], sum & 0xFFu, Vx[i]);
+                    }
+                    break;
+                case 0x5:
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        VF[i] = Pick(on[i], Vx[i] > Vy[i], VF[i]);
+                        Vx[i] = Pick(on[i], Vx[i] - Vy[i], Vx[i]);
+                    }
+                    break;
+                case 0x6:
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        VF[i] = Pick(on[i], Vx[i] & 0x1u, VF[i]);
+                        Vx[i] = Pick(on[i], Vx[i] >> 1u, Vx[i]);
+                    }
+                    break;
+                case 0x7:
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        VF[i] = Pick(on[i], Vy[i] > Vx[i], VF[i]);
+                        Vx[i] = Pick(on[i], Vy[i] - Vx[i], Vx[i]);
+                    }
+                    break;
+                case 0xE:
+                    for (size_t i = 0; i < n; ++i)
+                    {
+                        VF[i] = Pick(on[i], Vx[i] & 0x80u, VF[i]);
+                        Vx[i] = Pick(on[i], Vx[i] << 1u, Vx[i]);
+                    }
+                    break;
+            }
+            break;
+
+        case 0xA:
+            for (size_t i = 0; i < n; ++i) index[i] = Pick(on[i], nnn, index[i]);
+            break;
+
+        case 0xF:
+            switch (kk)
+            {
+                case 0x07:
+                    for (size_t i = 0; i < n; ++i) Vx[i] = Pick(on[i], delayTimer[i], Vx[i]);
+                    break;
+                case 0x15:
+                    for (size_t i = 0; i < n; ++i) delayTimer[i] = Pick(on[i], Vx[i], delayTimer[i]);
+                    break;
+                case 0x18:
+                    for (size_t i = 0; i < n; ++i) soundTimer[i] = Pick(on[i], Vx[i], soundTimer[i]);
+                    break;
+                case 0x1E:
+                    for (size_t i = 0; i < n; ++i) index[i] += on[i] * Vx[i];
+                    break;
+                default:
+                    if (Chip8::Decode(opcode) != &Chip8::OP_NULL)
+                    {
+                        return false;
+                    }
+                    break;
+            }
+            break;
+
+        default:
+            // invalid opcodes do nothing, so they can run anywhere
+            if (Chip8::Decode(opcode) != &Chip8::OP_NULL)
+            {
+                return false;
+            }
+            break;
+    }
+
+    // everything that doesn't jump or skip moves on to the next instruction
+    for (size_t i = 0; i < n; ++i) PC[i] += on[i] * 2;
+
+    return true;
+}
+
+void Chip8Batch::StepLane(size_t lane)
+{
+    Machine(lane).Cycle();
+    Reload(lane);
+
+    ++scalarInstructions;
+}
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "chip8memory.h"
+
+Memory::Memory()
+{
+#ifdef CHIP8_SHARED_MEMORY
+    // one zero page shared by every memory there is
+    // it always has this reference too, so it is never written
+    static std::shared_ptr<Block> const zeroPage = std::make_shared<Block>();
+
+    for (unsigned int page = 0; page < PAGES; ++page)
+    {
+        pages[page] = zeroPage;
+        bytes[page] = zeroPage->bytes;
+    }
+#endif
+}
+
+void Memory::Write(unsigned int address, uint8_t const* data, size_t size)
+{
+    while (size)
+    {
+        address &= SIZE - 1;
+
+        // the part of the data that lands on this page
+        unsigned int page = address / PAGE_SIZE;
+        unsigned int offset = address % PAGE_SIZE;
+        size_t count = std::min<size_t>(size, PAGE_SIZE - offset);
+
+#ifdef CHIP8_SHARED_MEMORY
+        // leave pages shared when nothing on them changes
+        if (memcmp(bytes[page] + offset, data, count) != 0)
+#endif
+        {
+            memcpy(Writable(page) + offset, data, count);
+        }
+
+        address += count;
+        data += count;
+        size -= count;
+    }
+}
+
+void Memory::Read(unsigned int address, uint8_t* data, size_t size) const
+{
+    while (size)
+    {
+        address &= SIZE - 1;
+
+        unsigned int page = address / PAGE_SIZE;
+        unsigned int offset = address % PAGE_SIZE;
+        size_t count = std::min<size_t>(size, PAGE_SIZE - offset);
+
+        memcpy(data, Page(page) + offset, count);
+
+        address += count;
+        data += count;
+        size -= count;
+    }
+}
+
+bool Memory::operator==(Memory const& other) const
+{
+    for (unsigned int page = 0; page < PAGES; ++page)
+    {
+        // shared pages are equal without looking at them
+        if (Page(page) != other.Page(page)
+            && memcmp(Page(page), other.Page(page), PAGE_SIZE) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Memory::operator!=(Memory const& other) const
+{
+    return !(*this == other);
+}
+
+unsigned int Memory::PrivatePages() const
+{
+#ifdef CHIP8_SHARED_MEMORY
+    unsigned int count = 0;
+
+    for (auto const& page : pages)
+    {
+        count += page.use_count() == 1;
+    }
+
+    return count;
+#else
+    return PAGES;
+#endif
+}
+
+#ifdef CHIP8_SHARED_MEMORY
+void Memory::Unshare(unsigned int page)
+{
+    pages[page] = std::make_shared<Block>(*pages[page]);
+    bytes[page] = pages[page]->bytes;
+}
+#endif
@@ -0,0 +1,36 @@
+#include <cstddef>
+#include <memory>
+
+#include "chip8.h"
+#include "chip8pool.h"
+
+// machines are cache line aligned, so they are also a whole number of lines
+static_assert(alignof(Chip8) == 64, "machines should start on a cache line");
+
+Chip8Pool::Chip8Pool(size_t count)
+    : machines(new Chip8[count])
+    , count(count)
+{
+}
+
+size_t Chip8Pool::Size() const
+{
+    return count;
+}
+
+Chip8& Chip8Pool::operator[](size_t i)
+{
+    return machines[i];
+}
+
+Chip8 const& Chip8Pool::operator[](size_t i) const
+{
+    return machines[i];
+}
+
+Chip8& Chip8Pool::Reset(size_t i)
+{
+    machines[i] = Chip8();
+
+    return machines[i];
+}
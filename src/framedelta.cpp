@@ -0,0 +1,119 @@
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "constants.h"
+#include "framedelta.h"
+
+static void PutWord(std::vector<uint8_t>& out, uint64_t value)
+{
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+static uint64_t GetWord(uint8_t const* data)
+{
+    uint64_t value = 0;
+
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+        value |= uint64_t(data[i]) << (8 * i);
+    }
+
+    return value;
+}
+
+// the rows of the current resolution that rowMask can refer to
+static uint64_t Rows(bool hires, uint64_t rowMask)
+{
+    return hires ? rowMask : rowMask & ((1ull << VIDEO_HEIGHT) - 1);
+}
+
+static unsigned int RowWords(bool hires)
+{
+    return hires ? VIDEO_ROW_WORDS : 1;
+}
+
+static unsigned int RowCount(uint64_t rowMask)
+{
+    unsigned int count = 0;
+
+    for (; rowMask; rowMask &= rowMask - 1)
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+size_t FrameDeltaSize(bool hires, uint64_t rowMask)
+{
+    // the resolution, the mask, then the rows
+    return 1 + 8 + RowCount(Rows(hires, rowMask)) * VIDEO_PLANES * RowWords(hires) * 8;
+}
+
+void EncodeFrameDelta(std::vector<uint8_t>& out, PackedVideo const& video, bool hires, uint64_t rowMask)
+{
+    rowMask = Rows(hires, rowMask);
+    out.reserve(out.size() + FrameDeltaSize(hires, rowMask));
+
+    out.push_back(hires);
+    PutWord(out, rowMask);
+
+    for (unsigned int row = 0; row < HIRES_HEIGHT; ++row)
+    {
+        if (!(rowMask & (1ull << row)))
+        {
+            continue;
+        }
+
+        for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+        {
+            for (unsigned int word = 0; word < RowWords(hires); ++word)
+            {
+                PutWord(out, video[plane][row][word]);
+            }
+        }
+    }
+}
+
+bool DecodeFrameDelta(uint8_t const*& data, uint8_t const* end, PackedVideo& video, bool& hires)
+{
+    if (end - data < 9)
+    {
+        return false;
+    }
+
+    bool deltaHires = data[0] != 0;
+    uint64_t rowMask = Rows(deltaHires, GetWord(data + 1));
+
+    if (static_cast<size_t>(end - data) < FrameDeltaSize(deltaHires, rowMask))
+    {
+        return false;
+    }
+
+    data += 9;
+
+    for (unsigned int row = 0; row < HIRES_HEIGHT; ++row)
+    {
+        if (!(rowMask & (1ull << row)))
+        {
+            continue;
+        }
+
+        for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+        {
+            for (unsigned int word = 0; word < RowWords(deltaHires); ++word)
+            {
+                video[plane][row][word] = GetWord(data);
+                data += 8;
+            }
+        }
+    }
+
+    hires = deltaHires;
+
+    return true;
+}
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+#include "framemailbox.h"
+
+FrameMailbox::Frame& FrameMailbox::Back()
+{
+    return frames[back];
+}
+
+void FrameMailbox::Publish()
+{
+    Frame& frame = frames[back];
+    frame.number = ++published;
+    frame.published = Clock::now();
+
+    // the frame has to be written before the consumer can take it
+    unsigned int previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+    back = previous & ~FRESH;
+
+    if (previous & FRESH)
+    {
+        ++dropped;
+    }
+}
+
+FrameMailbox::Frame const* FrameMailbox::Take()
+{
+    if (!(middle.load(std::memory_order_relaxed) & FRESH))
+    {
+        return nullptr;
+    }
+
+    // the producer has to be done with the frame before it is read
+    front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+    taken = &frames[front];
+
+    return taken;
+}
+
+void FrameMailbox::Presented()
+{
+    if (!taken)
+    {
+        return;
+    }
+
+    double latency = std::chrono::duration<double>(Clock::now() - taken->published).count();
+
+    ++presented;
+    latencySum += latency;
+    latencyMax = std::max(latencyMax, latency);
+    taken = nullptr;
+}
+
+void FrameMailbox::Report(std::ostream& out) const
+{
+    double mean = presented ? latencySum / presented : 0.0;
+
+    out << "published: " << published
+        << " presented: " << presented
+        << " dropped: " << dropped
+        << " latency mean: " << mean * 1000.0 << "ms"
+        << " max: " << latencyMax * 1000.0 << "ms\n";
+}
@@ -0,0 +1,171 @@
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "inputlog.h"
+
+// the header is written byte by byte in little endian order,
+// so logs can be shared between hosts
+static void PutInteger(std::vector<uint8_t>& out, uint64_t value, unsigned int bytes)
+{
+    for (unsigned int i = 0; i < bytes; ++i)
+    {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+// 7 bits at a time, with the top bit set on every byte but the last
+static void PutVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// reads from data, advancing it, and returns false when it runs out
+static bool GetInteger(uint8_t const*& data, uint8_t const* end, uint64_t& value, unsigned int bytes)
+{
+    if (static_cast<size_t>(end - data) < bytes)
+    {
+        return false;
+    }
+
+    value = 0;
+
+    for (unsigned int i = 0; i < bytes; ++i)
+    {
+        value |= uint64_t(*data++) << (8 * i);
+    }
+
+    return true;
+}
+
+static bool GetVarint(uint8_t const*& data, uint8_t const* end, uint64_t& value)
+{
+    value = 0;
+
+    for (unsigned int shift = 0; shift < 64; shift += 7)
+    {
+        if (data == end)
+        {
+            return false;
+        }
+
+        uint8_t byte = *data++;
+        value |= uint64_t(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void InputLog::Record(uint64_t cycle, uint8_t key, bool pressed)
+{
+    events.push_back(Event{ cycle, static_cast<uint8_t>(key & 0xF), pressed });
+}
+
+bool InputLog::Save(char const* filename) const
+{
+    std::vector<uint8_t> bytes;
+
+    PutInteger(bytes, MAGIC, 4);
+    PutInteger(bytes, VERSION, 2);
+    PutInteger(bytes, 0, 2);
+    PutInteger(bytes, seed, 8);
+    PutInteger(bytes, romHash, 8);
+    PutInteger(bytes, cycles, 8);
+    PutInteger(bytes, instructionsPerFrame, 4);
+    PutInteger(bytes, frameFraction, 4);
+    PutInteger(bytes, events.size(), 4);
+
+    uint64_t last = 0;
+
+    for (Event const& event : events)
+    {
+        PutVarint(bytes, event.cycle - last);
+        bytes.push_back(static_cast<uint8_t>(event.key | (event.pressed ? 0x10 : 0)));
+        last = event.cycle;
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<char const*>(bytes.data()), bytes.size());
+
+    return file.good();
+}
+
+bool InputLog::Load(char const* filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    uint8_t const* data = bytes.data();
+    uint8_t const* end = data + bytes.size();
+
+    uint64_t magic, version, reserved, count, perFrame;
+    uint64_t fraction = 0;
+    InputLog log;
+
+    if (!GetInteger(data, end, magic, 4) || magic != MAGIC
+        || !GetInteger(data, end, version, 2) || version < 1 || version > VERSION
+        || !GetInteger(data, end, reserved, 2)
+        || !GetInteger(data, end, log.seed, 8)
+        || !GetInteger(data, end, log.romHash, 8)
+        || !GetInteger(data, end, log.cycles, 8)
+        || !GetInteger(data, end, perFrame, 4)
+        || (version >= 2 && !GetInteger(data, end, fraction, 4))
+        || !GetInteger(data, end, count, 4))
+    {
+        return false;
+    }
+
+    log.instructionsPerFrame = static_cast<uint32_t>(perFrame);
+    log.frameFraction = static_cast<uint32_t>(fraction);
+    uint64_t cycle = 0;
+
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        uint64_t delta;
+
+        if (!GetVarint(data, end, delta) || data == end)
+        {
+            return false;
+        }
+
+        uint8_t key = *data++;
+        cycle += delta;
+        log.Record(cycle, key & 0xF, key & 0x10);
+    }
+
+    *this = std::move(log);
+
+    return true;
+}
+
+uint64_t InputLog::HashRom(uint8_t const* data, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
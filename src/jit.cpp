@@ -0,0 +1,572 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+
+#include "blockcache.h"
+#include "chip8.h"
+#include "jit.h"
+
+// jit.h decides whether this is a host the recompiler supports
+#ifdef CHIP8_JIT_X64
+#include <sys/mman.h>
+#endif
+
+// executable memory reserved for generated code
+const size_t CODE_SIZE = 1 << 20;
+// the room needed to compile one more block
+// no instruction compiles to more than 48 bytes
+const size_t MAX_BLOCK_CODE = 48 * BlockCache::MAX_BLOCK_LENGTH + 64;
+// the number of interpreter calls the generated code can hold at once
+const size_t MAX_CALLS = 0x4000;
+
+// do two machines agree on everything the hash covers, plus the opcode
+// writtenPages is left out because only the Jit consumes it
+static bool SameState(Chip8 const& a, Chip8 const& b)
+{
+    return memcmp(a.registers, b.registers, sizeof(a.registers)) == 0
+        && a.index == b.index
+        && a.pc == b.pc
+        && memcmp(a.stack, b.stack, sizeof(a.stack)) == 0
+        && a.sp == b.sp
+        && a.delayTimer == b.delayTimer
+        && a.soundTimer == b.soundTimer
+        && a.opcode == b.opcode
+        && a.memory == b.memory
+        && memcmp(a.video, b.video, sizeof(a.video)) == 0
+        && a.hires == b.hires
+        && a.planes == b.planes
+        && memcmp(a.flags, b.flags, sizeof(a.flags)) == 0;
+}
+
+// called by generated code to run a single instruction on the interpreter
+static void ExecuteCall(Chip8* chip8, Jit::Call const* call)
+{
+    // the same steps as Chip8::Cycle, minus fetching and decoding
+    chip8->opcode = call->opcode;
+    chip8->pc = call->next;
+    (chip8->*(call->handler))();
+}
+
+#ifdef CHIP8_JIT_X64
+
+// X86-64 CODE GENERATION
+// the generated code is a function void(Chip8*) following the SysV ABI
+// the machine pointer lives in rbx for the whole block, and every piece
+// of guest state is addressed relative to it
+// the PC is known at compile time inside a block, so it is only written
+// back before calling the interpreter and when leaving the block
+namespace
+{
+
+// the offsets of guest state inside the machine
+const int32_t REGISTERS = offsetof(Chip8, registers);
+const int32_t INDEX = offsetof(Chip8, index);
+const int32_t PC = offsetof(Chip8, pc);
+const int32_t OPCODE = offsetof(Chip8, opcode);
+
+int32_t V(unsigned int x)
+{
+    return REGISTERS + x;
+}
+
+// writes machine code into a buffer, the caller guarantees it fits
+class Emitter
+{
+public:
+    explicit Emitter(uint8_t* at) : at(at) {}
+
+    uint8_t* at;
+
+    void Byte(uint8_t value)
+    {
+        *at++ = value;
+    }
+
+    void Bytes(std::initializer_list<uint8_t> values)
+    {
+        for (uint8_t value : values)
+        {
+            Byte(value);
+        }
+    }
+
+    void Word(uint16_t value)
+    {
+        memcpy(at, &value, sizeof(value));
+        at += sizeof(value);
+    }
+
+    void Dword(uint32_t value)
+    {
+        memcpy(at, &value, sizeof(value));
+        at += sizeof(value);
+    }
+
+    void Qword(uint64_t value)
+    {
+        memcpy(at, &value, sizeof(value));
+        at += sizeof(value);
+    }
+
+    // an instruction with a [rbx + disp32] operand
+    // reg is the register (or opcode extension) for the ModRM byte
+    void Mem(std::initializer_list<uint8_t> op, uint8_t reg, int32_t disp)
+    {
+        Bytes(op);
+        Byte(0x80 | (reg << 3) | 0x3);
+        Dword(disp);
+    }
+
+    // mov word [rbx + PC], address
+    void StorePC(uint16_t address)
+    {
+        Mem({ 0x66, 0xC7 }, 0, PC);
+        Word(address);
+    }
+
+    // the PC after a skip: next, or next + 2 if the flags say equal
+    // cmove is used for SE and cmovne for SNE
+    void SkipIf(bool equal, uint16_t next)
+    {
+        // mov ecx, next
+        Byte(0xB9);
+        Dword(next);
+        // lea edx, [rcx + 2]
+        Bytes({ 0x8D, 0x51, 0x02 });
+        // cmove/cmovne ecx, edx
+        Bytes({ 0x0F, static_cast<uint8_t>(equal ? 0x44 : 0x45), 0xCA });
+        // mov [rbx + PC], cx
+        Mem({ 0x66, 0x89 }, 1, PC);
+    }
+
+    // mov rdi, rbx ; mov rax, function ; call rax
+    // the caller has loaded the second argument into rsi
+    void CallWithMachine(void const* function)
+    {
+        Bytes({ 0x48, 0x89, 0xDF });
+        Bytes({ 0x48, 0xB8 });
+        Qword(reinterpret_cast<uint64_t>(function));
+        Bytes({ 0xFF, 0xD0 });
+    }
+};
+
+// Compile one instruction natively if it is one of the supported opcodes
+// returns whether it was compiled, and sets ends if it left the block
+bool EmitNative(Emitter& e, uint16_t opcode, uint16_t next, bool& ends)
+{
+    uint8_t x = (opcode & 0x0F00u) >> 8u;
+    uint8_t y = (opcode & 0x00F0u) >> 4u;
+    uint8_t kk = opcode & 0x00FFu;
+    uint16_t nnn = opcode & 0x0FFFu;
+
+    ends = false;
+
+    switch (opcode >> 12u)
+    {
+        case 0x1:
+            e.StorePC(nnn);
+            ends = true;
+            return true;
+
+        case 0x3:
+        case 0x4:
+            // cmp byte [Vx], kk
+            e.Mem({ 0x80 }, 7, V(x));
+            e.Byte(kk);
+            e.SkipIf((opcode >> 12u) == 0x3, next);
+            ends = true;
+            return true;
+
+        case 0x5:
+        case 0x9:
+            // only 5xy0 and 9xy0 exist, but the tables ignore the last nibble
+            // mov al, [Vx] ; cmp al, [Vy]
+            e.Mem({ 0x8A }, 0, V(x));
+            e.Mem({ 0x3A }, 0, V(y));
+            e.SkipIf((opcode >> 12u) == 0x5, next);
+            ends = true;
+            return true;
+
+        case 0x6:
+            // mov byte [Vx], kk
+            e.Mem({ 0xC6 }, 0, V(x));
+            e.Byte(kk);
+            return true;
+
+        case 0x7:
+            // add byte [Vx], kk
+            e.Mem({ 0x80 }, 0, V(x));
+            e.Byte(kk);
+            return true;
+
+        case 0x8:
+            break;
+
+        case 0xA:
+            // mov word [I], nnn
+            e.Mem({ 0x66, 0xC7 }, 0, INDEX);
+            e.Word(nnn);
+            return true;
+
+        case 0xF:
+            if (kk == 0x1E)
+            {
+                // movzx eax, byte [Vx] ; add word [I], ax
+                e.Mem({ 0x0F, 0xB6 }, 0, V(x));
+                e.Mem({ 0x66, 0x01 }, 0, INDEX);
+                return true;
+            }
+            return false;
+
+        default:
+            return false;
+    }
+
+    // the 8xy_ ALU ops
+    // the flag is always written before Vx, and anything read after
+    // writing the flag is read again, so that x or y being F behaves
+    // exactly like the interpreter
+    switch (opcode & 0x000Fu)
+    {
+        case 0x0:
+            // mov al, [Vy] ; mov [Vx], al
+            e.Mem({ 0x8A }, 0, V(y));
+            e.Mem({ 0x88 }, 0, V(x));
+            return true;
+
+        case 0x1:
+        case 0x2:
+        case 0x3:
+        {
+            // mov al, [Vy] ; or/and/xor [Vx], al
+            static const uint8_t ops[] = { 0x00, 0x08, 0x20, 0x30 };
+            e.Mem({ 0x8A }, 0, V(y));
+            e.Mem({ ops[opcode & 0x000Fu] }, 0, V(x));
+            return true;
+        }
+
+        case 0x4:
+            // movzx eax, [Vx] ; movzx ecx, [Vy] ; add eax, ecx
+            e.Mem({ 0x0F, 0xB6 }, 0, V(x));
+            e.Mem({ 0x0F, 0xB6 }, 1, V(y));
+            e.Bytes({ 0x01, 0xC8 });
+            // mov edx, eax ; shr edx, 8 ; mov [VF], dl ; mov [Vx], al
+            e.Bytes({ 0x89, 0xC2 });
+            e.Bytes({ 0xC1, 0xEA, 0x08 });
+            e.Mem({ 0x88 }, 2, V(0xF));
+            e.Mem({ 0x88 }, 0, V(x));
+            return true;
+
+        case 0x5:
+        case 0x7:
+        {
+            bool reverse = (opcode & 0x000Fu) == 0x7;
+            // movzx eax, [Vx] ; movzx ecx, [Vy]
+            e.Mem({ 0x0F, 0xB6 }, 0, V(x));
+            e.Mem({ 0x0F, 0xB6 }, 1, V(y));
+            // cmp eax, ecx (or ecx, eax) ; seta dl ; mov [VF], dl
+            e.Bytes({ 0x39, static_cast<uint8_t>(reverse ? 0xC1 : 0xC8) });
+            e.Bytes({ 0x0F, 0x97, 0xC2 });
+            e.Mem({ 0x88 }, 2, V(0xF));
+            // mov al, [first] ; sub al, [second] ; mov [Vx], al
+            e.Mem({ 0x8A }, 0, V(reverse ? y : x));
+            e.Mem({ 0x2A }, 0, V(reverse ? x : y));
+            e.Mem({ 0x88 }, 0, V(x));
+            return true;
+        }
+
+        case 0x6:
+        case 0xE:
+        {
+            bool left = (opcode & 0x000Fu) == 0xE;
+            // mov al, [Vx] ; and al, 1 (or 0x80) ; mov [VF], al
+            e.Mem({ 0x8A }, 0, V(x));
+            e.Bytes({ 0x24, static_cast<uint8_t>(left ? 0x80 : 0x01) });
+            e.Mem({ 0x88 }, 0, V(0xF));
+            // shl/shr byte [Vx], 1
+            e.Mem({ 0xD0 }, left ? 4 : 5, V(x));
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
+
+}
+
+#endif
+
+Jit::Jit()
+    : calls(new Call[MAX_CALLS])
+{
+#ifdef CHIP8_JIT_X64
+    void* memory = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    // if the host refuses writable and executable memory, interpret instead
+    if (memory != MAP_FAILED)
+    {
+        code = static_cast<uint8_t*>(memory);
+    }
+#endif
+}
+
+Jit::~Jit()
+{
+#ifdef CHIP8_JIT_X64
+    if (code)
+    {
+        munmap(code, CODE_SIZE);
+    }
+#endif
+}
+
+bool Jit::Native() const
+{
+    return code != nullptr;
+}
+
+unsigned long Jit::Run(Chip8& chip8, unsigned long cycles)
+{
+    unsigned long executed = 0;
+
+    while (executed < cycles)
+    {
+        executed += Step(chip8, cycles - executed);
+    }
+
+    return executed;
+}
+
+unsigned long Jit::Step(Chip8& chip8, unsigned long cycles)
+{
+    // drop anything the last block wrote over
+    if (chip8.writtenPages)
+    {
+        if (chip8.writtenPages & cachedPages)
+        {
+            Invalidate(chip8.writtenPages);
+        }
+
+        chip8.writtenPages = 0;
+    }
+
+    uint16_t pc = chip8.pc;
+    Block const* block = nullptr;
+
+    // an instruction has to fit in memory to be compiled
+    if (Native() && pc + 1u < Memory::SIZE)
+    {
+        block = blockAt[pc] ? &blocks[blockAt[pc] - 1] : Translate(chip8, pc);
+    }
+
+    // generated code always runs a whole block
+    // so single step the interpreter when the budget ends inside one
+    if (!block || block->length > cycles)
+    {
+        chip8.Cycle();
+        return 1;
+    }
+
+    block->code(&chip8);
+    return block->length;
+}
+
+unsigned long Jit::Lockstep(Chip8& chip8, Chip8& reference, unsigned long cycles)
+{
+    unsigned long executed = 0;
+
+    while (executed < cycles)
+    {
+        unsigned long count = Step(chip8, cycles - executed);
+
+        for (unsigned long i = 0; i < count; ++i)
+        {
+            reference.Cycle();
+        }
+
+        if (!SameState(chip8, reference))
+        {
+            return executed;
+        }
+
+        executed += count;
+    }
+
+    return executed;
+}
+
+void Jit::Flush()
+{
+    memset(blockAt, 0, sizeof(blockAt));
+    blocks.clear();
+    codeUsed = 0;
+    callsUsed = 0;
+    cachedPages = 0;
+}
+
+void Jit::Prewarm(Chip8& chip8, RomAnalysis const& analysis)
+{
+    // loading the ROM marked its pages as written, which the first Step
+    // would otherwise take as the program writing over what was compiled here
+    if (chip8.writtenPages & cachedPages)
+    {
+        Invalidate(chip8.writtenPages);
+    }
+
+    chip8.writtenPages = 0;
+
+    if (!Native())
+    {
+        return;
+    }
+
+    for (RomAnalysis::Block const& block : analysis.blocks)
+    {
+        if (Full())
+        {
+            break;
+        }
+
+        if (!blockAt[block.start])
+        {
+            Translate(chip8, block.start);
+        }
+    }
+}
+
+bool Jit::Full() const
+{
+    return codeUsed + MAX_BLOCK_CODE > CODE_SIZE
+        || callsUsed + BlockCache::MAX_BLOCK_LENGTH > MAX_CALLS
+        || blocks.size() >= 0xFFFF;
+}
+
+Jit::Block const* Jit::Translate(Chip8 const& chip8, uint16_t pc)
+{
+#ifdef CHIP8_JIT_X64
+    // start over once the code buffer is full
+    // blockAt holds 16 bit indices, so the number of blocks is limited too
+    if (Full())
+    {
+        Flush();
+    }
+
+    Block block{};
+    block.start = pc;
+    block.code = reinterpret_cast<void (*)(Chip8*)>(code + codeUsed);
+
+    Emitter e(code + codeUsed);
+
+    // push rbx ; mov rbx, rdi
+    e.Byte(0x53);
+    e.Bytes({ 0x48, 0x89, 0xFB });
+
+    uint16_t address = pc;
+    // whether the last instruction already left the PC where it belongs
+    bool pcSet = false;
+    // the last instruction if it was compiled natively
+    // the interpreter records it in Chip8::opcode, so the block has to too
+    uint16_t lastNative = 0;
+    bool endsNative = false;
+
+    while (block.length < BlockCache::MAX_BLOCK_LENGTH && address + 1u < Memory::SIZE)
+    {
+        uint16_t opcode = (chip8.memory[address] << 8u) | chip8.memory[address + 1];
+        Chip8::Handler handler = chip8.Decode(opcode);
+        uint16_t next = address + 2;
+        bool ends = false;
+
+        ++block.length;
+        address = next;
+
+        if (EmitNative(e, opcode, next, ends))
+        {
+            pcSet = ends;
+            lastNative = opcode;
+            endsNative = true;
+        }
+        else
+        {
+            // hand the instruction to the interpreter
+            Call* call = &calls[callsUsed++];
+            call->handler = handler;
+            call->opcode = opcode;
+            call->next = next;
+
+            // mov rsi, call
+            e.Bytes({ 0x48, 0xBE });
+            e.Qword(reinterpret_cast<uint64_t>(call));
+            e.CallWithMachine(reinterpret_cast<void const*>(&ExecuteCall));
+
+            pcSet = true;
+            endsNative = false;
+            ends = BlockCache::EndsBlock(handler);
+        }
+
+        if (ends)
+        {
+            break;
+        }
+    }
+
+    if (!pcSet)
+    {
+        e.StorePC(address);
+    }
+
+    if (endsNative)
+    {
+        // mov word [rbx + OPCODE], opcode
+        e.Mem({ 0x66, 0xC7 }, 0, OPCODE);
+        e.Word(lastNative);
+    }
+
+    // pop rbx ; ret
+    e.Byte(0x5B);
+    e.Byte(0xC3);
+
+    codeUsed = e.at - code;
+
+    block.pages = Chip8::PageMask(pc, address - pc);
+    cachedPages |= block.pages;
+
+    blocks.push_back(block);
+    blockAt[pc] = blocks.size();
+    ++translations;
+
+    return &blocks.back();
+#else
+    (void)chip8;
+    (void)pc;
+    return nullptr;
+#endif
+}
+
+void Jit::Invalidate(uint64_t pages)
+{
+    cachedPages = 0;
+
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        Block const& block = blocks[i];
+
+        // skip blocks that were already dropped
+        if (blockAt[block.start] != i + 1)
+        {
+            continue;
+        }
+
+        if (block.pages & pages)
+        {
+            blockAt[block.start] = 0;
+            ++invalidations;
+        }
+        else
+        {
+            cachedPages |= block.pages;
+        }
+    }
+}
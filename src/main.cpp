@@ -1,49 +1,594 @@
-#include <iostream>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "beeper.h"
 #include "chip8.h"
 #include "platform.h"
 #include "constants.h"
+#include "framemailbox.h"
+#include "input.h"
+#include "inputlog.h"
+#include "pacer.h"
+#include "profile.h"
+#include "rewind.h"
+#include "romimage.h"
+#include "scheduler.h"
+#include "throughput.h"
+#include "video.h"
+
+// Show the rows of video set in dirtyRows
+// normally straight into the locked texture, but with upload
+// into pixels, which is then copied into the texture
+// returns false if nothing could be presented
+static bool Present(Platform& platform, PackedVideo const& video, bool hires, uint64_t dirtyRows,
+    bool upload, uint32_t* pixels)
+{
+    int videoPitch = sizeof(pixels[0]) * HIRES_WIDTH;
+
+    if (upload)
+    {
+        ExpandVideo(video, hires, dirtyRows, pixels, videoPitch);
+        platform.Update(pixels, videoPitch, ExpandedRows(hires, dirtyRows));
+
+        return true;
+    }
+
+    // a locked texture has to be written in full
+    // which is still only 2KB of packed pixels to expand
+    int texturePitch = 0;
+    void* texturePixels = platform.LockFrame(texturePitch);
+
+    if (!texturePixels)
+    {
+        return false;
+    }
+
+    ExpandVideo(video, hires, texturePixels, texturePitch);
+    platform.PresentFrame();
+
+    return true;
+}
+
+// When the next frame at 60Hz would be due, starting now
+// with --turbo the machine runs as fast as it can until then,
+// so presenting still happens at the display rate
+static Scheduler::Clock::time_point NextFrameDue()
+{
+    return Scheduler::Clock::now() + std::chrono::duration_cast<Scheduler::Clock::duration>(
+        std::chrono::duration<double>(1.0 / Scheduler::FRAME_RATE));
+}
+
+// Show the latest rate of the meter in the window title,
+// and with --mips on stdout too
+static void ShowThroughput(Platform& platform, Throughput const& meter, bool print)
+{
+    std::ostringstream title;
+    title << std::fixed << std::setprecision(2) << "CHIP-8 Emulator - " << meter.mips << " MIPS";
+    platform.SetTitle(title.str().c_str());
+
+    if (print)
+    {
+        std::cout << std::fixed << std::setprecision(3) << meter.mips << " MIPS ("
+            << meter.executedMips << " executed)" << std::defaultfloat << std::endl;
+    }
+}
+
+// what the emulation thread has run so far, for the throughput meter
+struct Progress
+{
+    std::atomic<uint64_t> cycles{};
+    std::atomic<uint64_t> idleCycles{};
+};
+
+// THREADED MODE
+// With --threaded the machine runs on a thread of its own, paced by its
+// own FramePacer, while the main thread handles SDL events and presents.
+// Neither waits for the other: finished frames reach the main thread
+// through a FrameMailbox, so presenting, however long vsync or the driver
+// takes, never holds up the machine, and key events reach the emulation
+// thread through a lock free queue, stamped with the time they came in. A frame
+// stands for the host time since the previous one, so each event is
+// applied at the cycle of the frame that falls at the same point of it,
+// one frame later than it happened, but with the time between key
+// presses kept down to the cycle. With --turbo the thread doesn't wait
+// for the pacer, and runs more frames after that one until the next
+// would be due.
+static void Emulate(Chip8& chip8, Scheduler& scheduler, Rewind& rewind, FramePacer& pacer,
+    KeyQueue& events, std::atomic<bool> const& rewinding, std::atomic<bool> const& quit,
+    FrameMailbox& mailbox, InputLog* log, bool turbo, Progress& progress)
+{
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point last = Clock::now();
+
+    while (!quit.load(std::memory_order_relaxed))
+    {
+        // rewinding steps back a frame at a time, even in turbo mode
+        if (!turbo || rewinding.load(std::memory_order_relaxed))
+        {
+            pacer.Wait();
+        }
+
+        Clock::time_point now = Clock::now();
+        double span = std::chrono::duration<double>(now - last).count();
+        unsigned long perFrame = scheduler.FrameLength();
+        unsigned long done = 0;
+
+        if (rewinding.load(std::memory_order_relaxed))
+        {
+            // the keys are whatever is held now, not what was held back then
+            uint8_t keypad[sizeof(chip8.keypad)];
+            memcpy(keypad, chip8.keypad, sizeof(keypad));
+
+            rewind.Pop(chip8);
+            memcpy(chip8.keypad, keypad, sizeof(keypad));
+        }
+        else
+        {
+            rewind.Push(chip8);
+        }
+
+        KeyEvent const* event;
+
+        while ((event = events.Front()) && event->time <= now)
+        {
+            if (!rewinding.load(std::memory_order_relaxed))
+            {
+                // events from before the last frame go at its very start
+                double at = std::chrono::duration<double>(event->time - last).count();
+                unsigned long cycle = span > 0 ? perFrame * std::max(at / span, 0.0) : 0;
+                cycle = std::min(cycle, perFrame);
+
+                if (cycle > done)
+                {
+                    scheduler.Run(chip8, cycle - done);
+                    done = cycle;
+                }
+            }
+
+            if (log && chip8.keypad[event->key] != event->pressed)
+            {
+                log->Record(scheduler.cycles, event->key, event->pressed);
+            }
+
+            chip8.keypad[event->key] = event->pressed;
+            events.Pop();
+        }
+
+        if (!rewinding.load(std::memory_order_relaxed))
+        {
+            scheduler.Run(chip8, perFrame - done);
+            scheduler.EndFrame(chip8);
+
+            if (turbo)
+            {
+                scheduler.RunUntil(chip8, NextFrameDue());
+            }
+        }
+
+        last = now;
+        progress.cycles.store(scheduler.cycles, std::memory_order_relaxed);
+        progress.idleCycles.store(scheduler.idleCycles, std::memory_order_relaxed);
+
+        if (chip8.dirtyRows)
+        {
+            FrameMailbox::Frame& frame = mailbox.Back();
+            memcpy(frame.video, chip8.video, sizeof(chip8.video));
+            frame.hires = chip8.hires;
+            mailbox.Publish();
+            chip8.dirtyRows = 0;
+        }
+    }
+}
+
+// Record the keys that differ between two keypads at cycle
+static void RecordKeys(InputLog& log, uint64_t cycle, uint8_t const* before, uint8_t const* after)
+{
+    for (uint8_t key = 0; key < 16; ++key)
+    {
+        if (before[key] != after[key])
+        {
+            log.Record(cycle, key, after[key]);
+        }
+    }
+}
 
 int main(int argc, char** argv) {
     // cout << "testing" << endl;
-    if (argc != 4)
+    // options come first, then the positional arguments
+    unsigned int instructionsPerFrame = 0;
+    // instructions per second, 0 unless given with --ips
+    double instructionsPerSecond = 0;
+    bool turbo = false;
+    bool printMips = false;
+    bool vsync = false;
+    bool upload = false;
+    bool threaded = false;
+    bool mute = false;
+    // the most sound queued up ahead of the audio device, in milliseconds
+    double audioLatency = 50;
+    // 0 means no seed, so every run is different
+    uint64_t seed = 0;
+    // where to save the input of the session, if anywhere
+    char const* recordFilename = nullptr;
+#ifdef CHIP8_PROFILE
+    // where to write the profile when the emulator quits
+    char const* profileFilename = nullptr;
+#endif
+    std::vector<char const*> positional;
+
+    for (int i = 1; i < argc; ++i)
     {
-        std::cerr << "Usage: " << argv[0] << "<Scale> <Delay> <ROM>\n";
+        std::string arg = argv[i];
+
+        if (arg == "--ipf" && i + 1 < argc)
+        {
+            instructionsPerFrame = std::stoul(argv[++i]);
+        }
+        else if (arg == "--ips" && i + 1 < argc)
+        {
+            instructionsPerSecond = std::stod(argv[++i]);
+        }
+        else if (arg == "--turbo")
+        {
+            turbo = true;
+        }
+        else if (arg == "--mips")
+        {
+            printMips = true;
+        }
+        else if (arg == "--vsync")
+        {
+            vsync = true;
+        }
+        else if (arg == "--upload")
+        {
+            upload = true;
+        }
+        else if (arg == "--threaded")
+        {
+            threaded = true;
+        }
+        else if (arg == "--mute")
+        {
+            mute = true;
+        }
+        else if (arg == "--audio-latency" && i + 1 < argc)
+        {
+            audioLatency = std::stod(argv[++i]);
+        }
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            seed = std::stoull(argv[++i]);
+        }
+        else if (arg == "--record" && i + 1 < argc)
+        {
+            recordFilename = argv[++i];
+        }
+        else if (arg == "--profile" && i + 1 < argc)
+        {
+#ifdef CHIP8_PROFILE
+            profileFilename = argv[++i];
+#else
+            std::cerr << "--profile needs a build with PROFILE=1\n";
+            std::exit(EXIT_FAILURE);
+#endif
+        }
+        else
+        {
+            positional.push_back(argv[i]);
+        }
+    }
+
+    if (positional.size() != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--ipf N] [--ips N] [--turbo] [--mips] [--vsync] [--upload] [--threaded] [--mute] [--audio-latency MS] [--seed N] [--record FILE] [--profile FILE] <Scale> <Delay> <ROM>\n";
         std::exit(EXIT_FAILURE);
     }
 
-    int videoScale = std::stoi(argv[1]);
-    int cycleDelay = std::stoi(argv[2]);
-    char const* romFilename = argv[3];
+    int videoScale = std::stoi(positional[0]);
+    double cycleDelay = std::stod(positional[1]);
+    char const* romFilename = positional[2];
+
+    // the delay is the time between instructions in milliseconds,
+    // which can be a fraction of one, unless --ips gave the rate or
+    // --ipf gave the instructions per frame explicitly
+    if (instructionsPerSecond <= 0 && instructionsPerFrame == 0)
+    {
+        instructionsPerSecond = 1000.0 / (cycleDelay > 0 ? cycleDelay : 1.0);
+    }
+
+    // turbo presents at its own pace, and the beeper couldn't keep up
+    if (turbo)
+    {
+        vsync = false;
+        mute = true;
+    }
+
+    // the audio device reads from the beeper until the platform closes it
+    Beeper beeper(48000, Scheduler::FRAME_RATE, audioLatency / 1000.0);
 
     Platform platform("CHIP-8 Emulator", VIDEO_WIDTH * videoScale,
-        VIDEO_HEIGHT * videoScale, VIDEO_WIDTH, VIDEO_HEIGHT);
+        VIDEO_HEIGHT * videoScale, HIRES_WIDTH, HIRES_HEIGHT, vsync);
 
     Chip8 chip8;
     chip8.loadROM(romFilename);
 
-    int videoPitch = sizeof(chip8.video[0]) * VIDEO_WIDTH;
+    // a recording has to be replayable, so it always has a seed
+    if (recordFilename && !seed)
+    {
+        seed = std::chrono::system_clock::now().time_since_epoch().count() | 1;
+    }
+
+    // a fixed seed makes OP_Cxkk, and so the whole run, reproducible
+    if (seed)
+    {
+        chip8.Seed(seed);
+    }
+
+    // the input of the session, along with everything needed to play it back
+    // rewinding would change the past, so it is off while recording
+    std::unique_ptr<InputLog> log;
+
+    if (recordFilename)
+    {
+        RomImage image(romFilename);
+
+        log = std::make_unique<InputLog>();
+        log->seed = seed;
+        log->romHash = InputLog::HashRom(image.Data(), image.Size());
+    }
+
+#ifdef CHIP8_PROFILE
+    std::unique_ptr<Profile> profile;
+
+    if (profileFilename)
+    {
+        profile = std::make_unique<Profile>();
+        chip8.profile = profile.get();
+    }
+#endif
+
+    Scheduler scheduler(instructionsPerFrame);
+
+    if (instructionsPerSecond > 0)
+    {
+        scheduler.SetRate(instructionsPerSecond);
+    }
+
+    if (log)
+    {
+        log->instructionsPerFrame = scheduler.instructionsPerFrame;
+        log->frameFraction = scheduler.frameFraction;
+    }
+
+    // device buffers of 512 samples add about 10ms to the beeper's latency
+    bool audio = !mute && platform.OpenAudio(beeper, 512);
+
+    if (audio)
+    {
+        scheduler.endOfFrame = [&beeper](Chip8& machine)
+        {
+            beeper.Frame(machine.soundTimer > 0);
+        };
+    }
+
+    // the display is kept packed, so it is expanded into RGBA to be shown
+    // and with --upload through this buffer
+    uint32_t pixels[HIRES_WIDTH * HIRES_HEIGHT]{};
+
+    // keep a few minutes of history to rewind through while backspace is held
+    // a keyframe every second, and deltas against it for the frames between
+    Rewind rewind(4 << 20, 3 * 60 * 60, 60);
 
-    auto lastCycleTime = std::chrono::high_resolution_clock::now();
+    FramePacer pacer(Scheduler::FRAME_RATE);
+    Throughput meter;
     bool quit = false;
 
-    while(!quit)
+    if (threaded)
+    {
+        KeyQueue events;
+        std::atomic<bool> rewinding{ false };
+        std::atomic<bool> stop{ false };
+        FrameMailbox mailbox;
+        Progress progress;
+
+        std::thread emulation(Emulate, std::ref(chip8), std::ref(scheduler), std::ref(rewind),
+            std::ref(pacer), std::ref(events), std::cref(rewinding), std::cref(stop), std::ref(mailbox), log.get(),
+            turbo, std::ref(progress));
+
+        // what is on screen, to find the rows a new frame changes
+        PackedVideo shown{};
+        bool shownHires = false;
+        bool shownAny = false;
+        // a frame that couldn't be presented yet
+        FrameMailbox::Frame const* pending = nullptr;
+
+        while (!quit)
+        {
+            // wake up for input at least every couple of milliseconds,
+            // to present any frame finished in the meantime
+            quit = platform.ProcessInput(events, 2);
+            rewinding.store(platform.RewindHeld() && !log, std::memory_order_relaxed);
+
+            if (meter.Sample(progress.cycles.load(std::memory_order_relaxed),
+                progress.idleCycles.load(std::memory_order_relaxed)))
+            {
+                ShowThroughput(platform, meter, printMips);
+            }
+
+            if (FrameMailbox::Frame const* latest = mailbox.Take())
+            {
+                pending = latest;
+            }
+
+            if (!pending)
+            {
+                continue;
+            }
+
+            // frames may have been dropped in between, so compare against
+            // what is shown rather than trusting the machine's dirty rows
+            uint64_t dirtyRows = shownAny && pending->hires == shownHires ? 0 : ~0ull;
+
+            for (unsigned int row = 0; row < HIRES_HEIGHT; ++row)
+            {
+                uint64_t changed = 0;
+
+                for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+                {
+                    for (unsigned int word = 0; word < VIDEO_ROW_WORDS; ++word)
+                    {
+                        changed |= pending->video[plane][row][word] ^ shown[plane][row][word];
+                    }
+                }
+
+                dirtyRows |= uint64_t(changed != 0) << row;
+            }
+
+            if (!dirtyRows || Present(platform, pending->video, pending->hires, dirtyRows, upload, pixels))
+            {
+                mailbox.Presented();
+                memcpy(shown, pending->video, sizeof(shown));
+                shownHires = pending->hires;
+                shownAny = true;
+                pending = nullptr;
+            }
+        }
+
+        stop.store(true, std::memory_order_relaxed);
+        emulation.join();
+
+        mailbox.Report(std::cout);
+    }
+    else
     {
-        quit = platform.ProcessInput(chip8.keypad);
+        while(!quit)
+        {
+            bool rewinding = platform.RewindHeld() && !log;
+            uint8_t previousKeys[sizeof(chip8.keypad)];
+            memcpy(previousKeys, chip8.keypad, sizeof(previousKeys));
+
+            quit = platform.ProcessInput(chip8.keypad);
+
+            if (log)
+            {
+                RecordKeys(*log, scheduler.cycles, previousKeys, chip8.keypad);
+            }
+
+            if (rewinding)
+            {
+                // step back a frame instead of running one
+                // the keys are whatever is held now, not what was held back then
+                uint8_t keypad[sizeof(chip8.keypad)];
+                memcpy(keypad, chip8.keypad, sizeof(keypad));
+
+                rewind.Pop(chip8);
+                memcpy(chip8.keypad, keypad, sizeof(keypad));
 
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();      
+                if (vsync)
+                {
+                    pacer.Mark();
+                }
+            }
+            else if (turbo)
+            {
+                // as many frames as fit before the next one is due
+                rewind.Push(chip8);
+                scheduler.RunUntil(chip8, NextFrameDue());
+            }
+            else if (vsync)
+            {
+                // presenting already waited for the display
+                // so run however many frames of emulated time that took
+                rewind.Push(chip8);
+                scheduler.Advance(chip8, pacer.Mark());
+            }
+            else
+            {
+                rewind.Push(chip8);
+                scheduler.RunFrame(chip8);
+            }
 
-        if(dt > cycleDelay)
+            // only upload and present rows that changed during the frame
+            bool presented = chip8.dirtyRows
+                && Present(platform, chip8.video, chip8.hires, chip8.dirtyRows, upload, pixels);
+
+            if (presented)
+            {
+                chip8.dirtyRows = 0;
+            }
+
+            if (meter.Sample(scheduler.cycles, scheduler.idleCycles))
+            {
+                ShowThroughput(platform, meter, printMips);
+            }
+
+            // sleep until the next frame instead of spinning on the clock
+            // vsync only paces frames that were actually presented,
+            // and turbo only paces rewinding
+            if ((!vsync || !presented) && (!turbo || rewinding))
+            {
+                pacer.Wait();
+            }
+        }
+    }
+
+    // the emulation thread is done, so the counts are final either way
+    meter.Sample(scheduler.cycles, scheduler.idleCycles);
+    pacer.Report(std::cout);
+    meter.Report(std::cout);
+
+    if (log)
+    {
+        log->cycles = scheduler.cycles;
+
+        if (!log->Save(recordFilename))
         {
-            lastCycleTime = currentTime;
+            std::cerr << "Could not write input log " << recordFilename << "\n";
+        }
+    }
 
-            chip8.Cycle();
+    if (audio)
+    {
+        std::cout << "audio underruns: " << beeper.underruns
+            << " overruns: " << beeper.overruns << " samples\n";
+    }
+
+#ifdef CHIP8_PROFILE
+    // a file ending in .folded gets folded stacks, anything else JSON
+    if (profile)
+    {
+        std::string name = profileFilename;
+        std::string suffix = ".folded";
+        std::ofstream out(profileFilename);
+        bool folded = name.size() >= suffix.size()
+            && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
 
-            platform.Update(chip8.video, videoPitch);
+        if (!out.is_open())
+        {
+            std::cerr << "Could not write profile " << profileFilename << "\n";
+        }
+        else if (folded)
+        {
+            profile->WriteFolded(out);
+        }
+        else
+        {
+            profile->WriteJson(out);
         }
     }
+#endif
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ostream>
+#include <thread>
+
+#include "pacer.h"
+
+FramePacer::FramePacer(double frameRate)
+    : period(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frameRate)))
+    , deadline(Clock::now() + period)
+    , last(Clock::now())
+{
+}
+
+void FramePacer::Wait()
+{
+    std::this_thread::sleep_until(deadline);
+
+    Clock::time_point now = Clock::now();
+    Record(std::chrono::duration<double>(now - deadline).count());
+
+    deadline += period;
+
+    // don't try to make up for frames that already passed
+    if (now >= deadline)
+    {
+        ++missed;
+        deadline = now + period;
+    }
+
+    last = now;
+}
+
+double FramePacer::Mark()
+{
+    Clock::time_point now = Clock::now();
+    double elapsed = std::chrono::duration<double>(now - last).count();
+
+    // the error is how far this frame was from one period after the last
+    Record(elapsed - std::chrono::duration<double>(period).count());
+
+    if (now - last >= 2 * period)
+    {
+        ++missed;
+    }
+
+    // a Wait after this sleeps until a period after this frame
+    deadline = now + period;
+    last = now;
+    return elapsed;
+}
+
+void FramePacer::Record(double error)
+{
+    ++frames;
+    errorSum += error;
+    errorSquaredSum += error * error;
+    errorMax = std::max(errorMax, std::abs(error));
+}
+
+void FramePacer::Report(std::ostream& out) const
+{
+    double mean = frames ? errorSum / frames : 0.0;
+    double variance = frames ? errorSquaredSum / frames - mean * mean : 0.0;
+
+    out << "frames: " << frames
+        << " missed: " << missed
+        << " jitter mean: " << mean * 1000.0 << "ms"
+        << " stddev: " << std::sqrt(std::max(variance, 0.0)) * 1000.0 << "ms"
+        << " max: " << errorMax * 1000.0 << "ms\n";
+}
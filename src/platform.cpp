@@ -1,17 +1,32 @@
+#include <chrono>
+
 #include <SDL2/SDL.h>
 
+#include "beeper.h"
+#include "input.h"
 #include "platform.h"
 
 Platform::Platform(char const* title,
     int windowWidth,
     int windowHeight,
     int textureWidth,
-    int textureHeight)
+    int textureHeight,
+    bool vsync)
+    : textureWidth(textureWidth)
+    , textureHeight(textureHeight)
 {
-    SDL_Init(SDL_INIT_VIDEO);
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
 
     window = SDL_CreateWindow(title, 0, 0, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    // with vsync, presenting blocks until the next display refresh
+    Uint32 rendererFlags = SDL_RENDERER_ACCELERATED;
+
+    if (vsync)
+    {
+        rendererFlags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+
+    renderer = SDL_CreateRenderer(window, -1, rendererFlags);
     texture = SDL_CreateTexture(
         renderer, SDL_PIXELFORMAT_RGBA8888,
         SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight
@@ -20,6 +35,11 @@ Platform::Platform(char const* title,
 
 Platform::~Platform()
 {
+    if (audioDevice)
+    {
+        SDL_CloseAudioDevice(audioDevice);
+    }
+
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -34,6 +54,124 @@ void Platform::Update(void const* buffer, int pitch)
     SDL_RenderPresent(renderer);
 }
 
+void Platform::Update(void const* buffer, int pitch, uint64_t rowMask)
+{
+    Uint8 const* pixels = static_cast<Uint8 const*>(buffer);
+    int row = 0;
+
+    // upload each run of consecutive changed rows with one call
+    while (row < textureHeight)
+    {
+        if (!(rowMask & (1ull << row)))
+        {
+            ++row;
+            continue;
+        }
+
+        int first = row;
+
+        while (row < textureHeight && (rowMask & (1ull << row)))
+        {
+            ++row;
+        }
+
+        SDL_Rect rect{ 0, first, textureWidth, row - first };
+        SDL_UpdateTexture(texture, &rect, pixels + first * pitch, pitch);
+    }
+
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
+
+void* Platform::LockFrame(int& pitch)
+{
+    void* pixels = nullptr;
+
+    if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0)
+    {
+        return nullptr;
+    }
+
+    return pixels;
+}
+
+void Platform::PresentFrame()
+{
+    SDL_UnlockTexture(texture);
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
+
+// The keypad key a keyboard key is mapped to, or -1 if it isn't one
+//  1 2 3 4        1 2 3 C
+//  q w e r   ->   4 5 6 D
+//  a s d f        7 8 9 E
+//  z x c v        A 0 B F
+static int KeypadKey(SDL_Keycode sym)
+{
+    switch (sym)
+    {
+        case SDLK_x: return 0;
+        case SDLK_1: return 1;
+        case SDLK_2: return 2;
+        case SDLK_3: return 3;
+        case SDLK_q: return 4;
+        case SDLK_w: return 5;
+        case SDLK_e: return 6;
+        case SDLK_a: return 7;
+        case SDLK_s: return 8;
+        case SDLK_d: return 9;
+        case SDLK_z: return 0xA;
+        case SDLK_c: return 0xB;
+        case SDLK_4: return 0xC;
+        case SDLK_r: return 0xD;
+        case SDLK_f: return 0xE;
+        case SDLK_v: return 0xF;
+        default: return -1;
+    }
+}
+
+bool Platform::HandleEvent(SDL_Event const& event, int& key, bool& pressed)
+{
+    bool quit = false;
+    key = -1;
+
+    switch (event.type)
+    {
+        case SDLK_ESCAPE:
+            quit = true;
+            break;
+
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+        {
+            pressed = event.type == SDL_KEYDOWN;
+
+            switch (event.key.keysym.sym)
+            {
+                case SDLK_ESCAPE:
+                {
+                    quit |= pressed;
+                } break;
+
+                case SDLK_BACKSPACE:
+                {
+                    rewindHeld = pressed;
+                } break;
+
+                default:
+                {
+                    key = KeypadKey(event.key.keysym.sym);
+                } break;
+            }
+        } break;
+    }
+
+    return quit;
+}
+
 bool Platform::ProcessInput(uint8_t* keys)
 {
     bool quit = false;
@@ -42,188 +180,88 @@ bool Platform::ProcessInput(uint8_t* keys)
 
     while (SDL_PollEvent(&event))
     {
-        switch (event.type)
+        int key = -1;
+        bool pressed = false;
+
+        quit |= HandleEvent(event, key, pressed);
+
+        if (key >= 0)
         {
-            case SDLK_ESCAPE:
-                quit = true;
-                break;
-            
-            case SDL_KEYDOWN:
-            {
-                switch (event.key.keysym.sym)
-                {
-                    case SDLK_ESCAPE: {
-                        quit = true;
-                    } break;
-
-                    case SDLK_x: {
-                        keys[0] = 1;
-                    } break;
-
-                    case SDLK_1:
-                    {
-                        keys[1] = 1;
-                    } break;
-
-                    case SDLK_2:
-                    {
-                        keys[2] = 1;
-                    } break;
-
-                    case SDLK_3:
-                    {
-                        keys[3] = 1;
-                    } break;
-
-                    case SDLK_q:
-                    {
-                        keys[4] = 1;
-                    } break;
-
-                    case SDLK_w:
-                    {
-                        keys[5] = 1;
-                    } break;
-
-                    case SDLK_e:
-                    {
-                        keys[6] = 1;
-                    } break;
-
-                    case SDLK_a:
-                    {
-                        keys[7] = 1;
-                    } break;
-
-                    case SDLK_s:
-                    {
-                        keys[8] = 1;
-                    } break;
-
-                    case SDLK_d:
-                    {
-                        keys[9] = 1;
-                    } break;
-
-                    case SDLK_z:
-                    {
-                        keys[0xA] = 1;
-                    } break;
-
-                    case SDLK_c:
-                    {
-                        keys[0xB] = 1;
-                    } break;
-
-                    case SDLK_4:
-                    {
-                        keys[0xC] = 1;
-                    } break;
-
-                    case SDLK_r:
-                    {
-                        keys[0xD] = 1;
-                    } break;
-
-                    case SDLK_f:
-                    {
-                        keys[0xE] = 1;
-                    } break;
-
-                    case SDLK_v:
-                    {
-                        keys[0xF] = 1;
-                    } break;
-                }
-            } break;
-            
-            case SDL_KEYUP:
-            {
-                switch (event.key.keysym.sym)
-                {
-                    case SDLK_x:
-                    {
-                        keys[0] = 0;
-                    } break;
-
-                    case SDLK_1:
-                    {
-                        keys[1] = 0;
-                    } break;
-
-                    case SDLK_2:
-                    {
-                        keys[2] = 0;
-                    } break;
-
-                    case SDLK_3:
-                    {
-                        keys[3] = 0;
-                    } break;
-
-                    case SDLK_q:
-                    {
-                        keys[4] = 0;
-                    } break;
-
-                    case SDLK_w:
-                    {
-                        keys[5] = 0;
-                    } break;
-
-                    case SDLK_e:
-                    {
-                        keys[6] = 0;
-                    } break;
-
-                    case SDLK_a:
-                    {
-                        keys[7] = 0;
-                    } break;
-
-                    case SDLK_s:
-                    {
-                        keys[8] = 0;
-                    } break;
-
-                    case SDLK_d:
-                    {
-                        keys[9] = 0;
-                    } break;
-
-                    case SDLK_z:
-                    {
-                        keys[0xA] = 0;
-                    } break;
-
-                    case SDLK_c:
-                    {
-                        keys[0xB] = 0;
-                    } break;
-
-                    case SDLK_4:
-                    {
-                        keys[0xC] = 0;
-                    } break;
-
-                    case SDLK_r:
-                    {
-                        keys[0xD] = 0;
-                    } break;
-
-                    case SDLK_f:
-                    {
-                        keys[0xE] = 0;
-                    } break;
-
-                    case SDLK_v:
-                    {
-                        keys[0xF] = 0;
-                    } break;
-                }
-            } break;
+            keys[key] = pressed;
         }
     }
 
     return quit;
 }
+
+bool Platform::ProcessInput(KeyQueue& events, int timeout)
+{
+    bool quit = false;
+
+    SDL_Event event;
+    // wait for the first event, and take whatever else is there with it
+    bool received = SDL_WaitEventTimeout(&event, timeout) != 0;
+
+    while (received)
+    {
+        int key = -1;
+        bool pressed = false;
+
+        quit |= HandleEvent(event, key, pressed);
+
+        // events are timestamped as they are taken off the SDL queue,
+        // which has a finer clock than the event's own timestamp
+        // a full queue drops the event, which means the emulation
+        // thread has stopped taking them anyway
+        if (key >= 0)
+        {
+            events.Push(KeyEvent{ std::chrono::steady_clock::now(),
+                static_cast<uint8_t>(key), pressed });
+        }
+
+        received = SDL_PollEvent(&event) != 0;
+    }
+
+    return quit;
+}
+
+bool Platform::RewindHeld() const
+{
+    return rewindHeld;
+}
+
+void Platform::SetTitle(char const* title)
+{
+    SDL_SetWindowTitle(window, title);
+}
+
+// called by SDL from its audio thread whenever the device needs samples
+static void FillAudio(void* userdata, Uint8* stream, int length)
+{
+    static_cast<Beeper*>(userdata)->Fill(reinterpret_cast<int16_t*>(stream),
+        length / sizeof(int16_t));
+}
+
+bool Platform::OpenAudio(Beeper& beeper, unsigned int bufferSamples)
+{
+    SDL_AudioSpec wanted{};
+    wanted.freq = beeper.SampleRate();
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = bufferSamples;
+    wanted.callback = FillAudio;
+    wanted.userdata = &beeper;
+
+    // no changes are allowed, SDL converts to whatever the device wants
+    SDL_AudioSpec obtained{};
+    audioDevice = SDL_OpenAudioDevice(nullptr, 0, &wanted, &obtained, 0);
+
+    if (!audioDevice)
+    {
+        return false;
+    }
+
+    SDL_PauseAudioDevice(audioDevice, 0);
+
+    return true;
+}
@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "chip8.h"
+#include "profile.h"
+
+// every opcode function, with the name of the instruction it executes
+static const std::pair<Chip8::Handler, char const*> families[] =
+{
+    { &Chip8::OP_00E0, "00E0" },
+    { &Chip8::OP_00EE, "00EE" },
+    { &Chip8::OP_00Cn, "00Cn" },
+    { &Chip8::OP_00Dn, "00Dn" },
+    { &Chip8::OP_00FB, "00FB" },
+    { &Chip8::OP_00FC, "00FC" },
+    { &Chip8::OP_00FD, "00FD" },
+    { &Chip8::OP_00FE, "00FE" },
+    { &Chip8::OP_00FF, "00FF" },
+    { &Chip8::OP_1nnn, "1nnn" },
+    { &Chip8::OP_2nnn, "2nnn" },
+    { &Chip8::OP_3xkk, "3xkk" },
+    { &Chip8::OP_4xkk, "4xkk" },
+    { &Chip8::OP_5xy0, "5xy0" },
+    { &Chip8::OP_6xkk, "6xkk" },
+    { &Chip8::OP_7xkk, "7xkk" },
+    { &Chip8::OP_8xy0, "8xy0" },
+    { &Chip8::OP_8xy1, "8xy1" },
+    { &Chip8::OP_8xy2, "8xy2" },
+    { &Chip8::OP_8xy3, "8xy3" },
+    { &Chip8::OP_8xy4, "8xy4" },
+    { &Chip8::OP_8xy5, "8xy5" },
+    { &Chip8::OP_8xy6, "8xy6" },
+    { &Chip8::OP_8xy7, "8xy7" },
+    { &Chip8::OP_8xyE, "8xyE" },
+    { &Chip8::OP_9xy0, "9xy0" },
+    { &Chip8::OP_Annn, "Annn" },
+    { &Chip8::OP_Bnnn, "Bnnn" },
+    { &Chip8::OP_Cxkk, "Cxkk" },
+    { &Chip8::OP_Dxyn, "Dxyn" },
+    { &Chip8::OP_Ex9E, "Ex9E" },
+    { &Chip8::OP_ExA1, "ExA1" },
+    { &Chip8::OP_Fn01, "Fn01" },
+    { &Chip8::OP_Fx07, "Fx07" },
+    { &Chip8::OP_Fx0A, "Fx0A" },
+    { &Chip8::OP_Fx15, "Fx15" },
+    { &Chip8::OP_Fx18, "Fx18" },
+    { &Chip8::OP_Fx1E, "Fx1E" },
+    { &Chip8::OP_Fx29, "Fx29" },
+    { &Chip8::OP_Fx30, "Fx30" },
+    { &Chip8::OP_Fx33, "Fx33" },
+    { &Chip8::OP_Fx55, "Fx55" },
+    { &Chip8::OP_Fx65, "Fx65" },
+    { &Chip8::OP_Fx75, "Fx75" },
+    { &Chip8::OP_Fx85, "Fx85" },
+};
+
+void Profile::Clear()
+{
+    memset(opcodes, 0, sizeof(opcodes));
+    memset(addresses, 0, sizeof(addresses));
+    memset(lastOpcode, 0, sizeof(lastOpcode));
+    memset(followed, 0, sizeof(followed));
+    previous = Memory::SIZE;
+    drawNanoseconds = 0;
+    keyWaits = 0;
+}
+
+uint64_t Profile::Instructions() const
+{
+    uint64_t total = 0;
+
+    for (uint64_t count : addresses)
+    {
+        total += count;
+    }
+
+    return total;
+}
+
+char const* Profile::Family(uint16_t opcode)
+{
+    Chip8::Handler handler = Chip8::Decode(opcode);
+
+    for (auto const& family : families)
+    {
+        if (family.first == handler)
+        {
+            return family.second;
+        }
+    }
+
+    return "invalid";
+}
+
+// a 16 bit value as 0x followed by 3 or 4 hex digits
+static void WriteHex(std::ostream& out, unsigned int value, int digits)
+{
+    out << "0x" << std::hex << std::setw(digits) << std::setfill('0')
+        << value << std::dec << std::setfill(' ');
+}
+
+void Profile::WriteJson(std::ostream& out) const
+{
+    // add up the opcodes of every family
+    std::vector<std::pair<char const*, uint64_t>> counts;
+
+    for (unsigned int op = 0; op < 0x10000; ++op)
+    {
+        if (!opcodes[op])
+        {
+            continue;
+        }
+
+        char const* name = Family(static_cast<uint16_t>(op));
+        auto found = std::find_if(counts.begin(), counts.end(),
+            [name](std::pair<char const*, uint64_t> const& count)
+            {
+                return strcmp(count.first, name) == 0;
+            });
+
+        if (found == counts.end())
+        {
+            counts.emplace_back(name, opcodes[op]);
+        }
+        else
+        {
+            found->second += opcodes[op];
+        }
+    }
+
+    // busiest first, ties in name order so the output is reproducible
+    std::sort(counts.begin(), counts.end(),
+        [](std::pair<char const*, uint64_t> const& a, std::pair<char const*, uint64_t> const& b)
+        {
+            return a.second != b.second ? a.second > b.second : strcmp(a.first, b.first) < 0;
+        });
+
+    std::vector<unsigned int> busiest;
+
+    for (unsigned int address = 0; address < Memory::SIZE; ++address)
+    {
+        if (addresses[address])
+        {
+            busiest.push_back(address);
+        }
+    }
+
+    std::stable_sort(busiest.begin(), busiest.end(),
+        [this](unsigned int a, unsigned int b)
+        {
+            return addresses[a] > addresses[b];
+        });
+
+    // add up the pairs run back to back by the families of both halves
+    std::vector<std::pair<std::string, uint64_t>> pairs;
+
+    for (unsigned int address = 0; address + 2 < Memory::SIZE; ++address)
+    {
+        if (!followed[address])
+        {
+            continue;
+        }
+
+        std::string name = std::string(Family(lastOpcode[address])) + " " + Family(lastOpcode[address + 2]);
+        auto found = std::find_if(pairs.begin(), pairs.end(),
+            [&name](std::pair<std::string, uint64_t> const& pair)
+            {
+                return pair.first == name;
+            });
+
+        if (found == pairs.end())
+        {
+            pairs.emplace_back(name, followed[address]);
+        }
+        else
+        {
+            found->second += followed[address];
+        }
+    }
+
+    std::sort(pairs.begin(), pairs.end(),
+        [](std::pair<std::string, uint64_t> const& a, std::pair<std::string, uint64_t> const& b)
+        {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+
+    uint64_t draws = 0;
+
+    for (unsigned int op = 0xD000; op <= 0xDFFF; ++op)
+    {
+        draws += opcodes[op];
+    }
+
+    out << "{\n";
+    out << "  \"instructions\": " << Instructions() << ",\n";
+
+    out << "  \"families\": [";
+
+    for (size_t i = 0; i < counts.size(); ++i)
+    {
+        out << (i ? ",\n" : "\n") << "    { \"name\": \"" << counts[i].first
+            << "\", \"count\": " << counts[i].second << " }";
+    }
+
+    out << "\n  ],\n";
+
+    out << "  \"addresses\": [";
+
+    for (size_t i = 0; i < busiest.size(); ++i)
+    {
+        unsigned int address = busiest[i];
+
+        out << (i ? ",\n" : "\n") << "    { \"address\": \"";
+        WriteHex(out, address, 3);
+        out << "\", \"opcode\": \"";
+        WriteHex(out, lastOpcode[address], 4);
+        out << "\", \"family\": \"" << Family(lastOpcode[address])
+            << "\", \"count\": " << addresses[address] << " }";
+    }
+
+    out << "\n  ],\n";
+
+    out << "  \"pairs\": [";
+
+    for (size_t i = 0; i < pairs.size(); ++i)
+    {
+        out << (i ? ",\n" : "\n") << "    { \"pair\": \"" << pairs[i].first
+            << "\", \"count\": " << pairs[i].second << " }";
+    }
+
+    out << "\n  ],\n";
+
+    out << "  \"draw\": { \"count\": " << draws
+        << ", \"nanoseconds\": " << drawNanoseconds
+        << ", \"ns_per_draw\": " << (draws ? double(drawNanoseconds) / draws : 0.0) << " },\n";
+    out << "  \"key_waits\": " << keyWaits << "\n";
+    out << "}\n";
+}
+
+void Profile::WriteFolded(std::ostream& out) const
+{
+    for (unsigned int address = 0; address < Memory::SIZE; ++address)
+    {
+        if (!addresses[address])
+        {
+            continue;
+        }
+
+        out << "chip8;" << Family(lastOpcode[address]) << ";";
+        WriteHex(out, address, 3);
+        out << " " << addresses[address] << "\n";
+    }
+}
@@ -0,0 +1,265 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "chip8.h"
+#include "rewind.h"
+
+// ENCODING
+// an encoded frame is a list of runs, each of which is
+//  - a 16 bit count of bytes that are the same as in the base state
+//  - a 16 bit count of bytes that differ
+//  - those differing bytes, XORed with the base
+// up to the size of a Chip8State
+// short stretches of equal bytes are folded into the differing bytes
+// since a new run would cost more than it saves
+const size_t MIN_ZERO_RUN = 4;
+
+// the worst case is a run header for every MIN_ZERO_RUN bytes
+const size_t MAX_ENCODED = 2 * sizeof(Chip8State) + 8;
+
+// the state every keyframe is relative to
+static Chip8State const zeroState{};
+
+static void WriteLength(uint8_t* at, size_t length)
+{
+    uint16_t value = static_cast<uint16_t>(length);
+    memcpy(at, &value, sizeof(value));
+}
+
+static size_t ReadLength(uint8_t const* at)
+{
+    uint16_t value;
+    memcpy(&value, at, sizeof(value));
+    return value;
+}
+
+Rewind::Rewind(size_t arenaBytes, size_t maxFrames, unsigned int keyframeInterval)
+    : arena(new uint8_t[arenaBytes])
+    , arenaSize(arenaBytes)
+    , entries(new Entry[maxFrames])
+    , entryCapacity(maxFrames)
+    , sinceKeyframe(keyframeInterval)
+    , keyframeInterval(keyframeInterval)
+    , scratch(new uint8_t[MAX_ENCODED])
+{
+}
+
+void Rewind::Push(Chip8 const& chip8)
+{
+    if (entryCapacity == 0)
+    {
+        return;
+    }
+
+    Chip8State state;
+    chip8.SaveState(state);
+
+    bool isKeyframe = sinceKeyframe >= keyframeInterval;
+    size_t length = Encode(state, isKeyframe ? zeroState : keyframe);
+
+    // a frame that doesn't fit at all can't be recorded
+    // and every frame after it needs a new keyframe
+    if (length > arenaSize)
+    {
+        sinceKeyframe = keyframeInterval;
+        return;
+    }
+
+    if (count == entryCapacity)
+    {
+        DropOldest();
+    }
+
+    // frames are never split, so wrap around if this one won't fit at the end
+    // whatever is left past the end is the oldest part of the history
+    if (writeOffset + length > arenaSize)
+    {
+        while (count && entries[first].offset >= writeOffset)
+        {
+            DropOldest();
+        }
+
+        writeOffset = 0;
+    }
+
+    // then make room by dropping the oldest frames
+    while (count && entries[first].offset < writeOffset + length
+        && entries[first].offset + entries[first].length > writeOffset)
+    {
+        DropOldest();
+    }
+
+    // the delta's keyframe is the newest one, so if making room dropped it
+    // then the whole history is gone, and this has to be a keyframe after all
+    if (!isKeyframe && sinceKeyframe >= keyframeInterval)
+    {
+        isKeyframe = true;
+        length = Encode(state, zeroState);
+        writeOffset = 0;
+
+        if (length > arenaSize)
+        {
+            return;
+        }
+    }
+
+    size_t slot = (first + count) % entryCapacity;
+    memcpy(&arena[writeOffset], scratch.get(), length);
+    entries[slot] = { writeOffset, length, isKeyframe ? slot : keyframeSlot };
+    ++count;
+    writeOffset += length;
+
+    if (isKeyframe)
+    {
+        keyframe = state;
+        keyframeSlot = slot;
+        sinceKeyframe = 0;
+    }
+
+    ++sinceKeyframe;
+}
+
+bool Rewind::Pop(Chip8& chip8)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+
+    size_t slot = (first + count - 1) % entryCapacity;
+    Entry const& entry = entries[slot];
+
+    // rebuild the keyframe, then apply the delta on top
+    Chip8State state = zeroState;
+
+    if (entry.keyframe != slot)
+    {
+        Decode(entries[entry.keyframe], state);
+    }
+
+    Decode(entry, state);
+    chip8.LoadState(state);
+
+    // the newest frame is always the last one written, so its space is free again
+    writeOffset = entry.offset;
+    --count;
+
+    // the machine has moved away from the current keyframe
+    // so what gets recorded next has to start from a new one
+    sinceKeyframe = keyframeInterval;
+
+    return true;
+}
+
+size_t Rewind::Frames() const
+{
+    return count;
+}
+
+size_t Rewind::BytesUsed() const
+{
+    size_t used = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        used += entries[(first + i) % entryCapacity].length;
+    }
+
+    return used;
+}
+
+size_t Rewind::Encode(Chip8State const& state, Chip8State const& base)
+{
+    uint8_t const* a = reinterpret_cast<uint8_t const*>(&state);
+    uint8_t const* b = reinterpret_cast<uint8_t const*>(&base);
+    size_t const size = sizeof(Chip8State);
+
+    size_t out = 0;
+    size_t i = 0;
+
+    while (i < size)
+    {
+        // the bytes that are the same
+        size_t same = i;
+
+        while (i < size && a[i] == b[i])
+        {
+            ++i;
+        }
+
+        size_t zeroRun = i - same;
+
+        // then the bytes that differ, up to the next long enough stretch
+        // of equal ones or the end
+        size_t literal = i;
+
+        while (i < size)
+        {
+            size_t equal = 0;
+
+            while (i + equal < size && a[i + equal] == b[i + equal] && equal < MIN_ZERO_RUN)
+            {
+                ++equal;
+            }
+
+            if (equal >= MIN_ZERO_RUN || i + equal == size)
+            {
+                break;
+            }
+
+            i += equal + 1;
+        }
+
+        WriteLength(&scratch[out], zeroRun);
+        WriteLength(&scratch[out + 2], i - literal);
+        out += 4;
+
+        for (size_t j = literal; j < i; ++j)
+        {
+            scratch[out++] = a[j] ^ b[j];
+        }
+    }
+
+    return out;
+}
+
+void Rewind::Decode(Entry const& entry, Chip8State& state) const
+{
+    uint8_t* s = reinterpret_cast<uint8_t*>(&state);
+    uint8_t const* in = &arena[entry.offset];
+    uint8_t const* end = in + entry.length;
+    size_t at = 0;
+
+    while (in < end)
+    {
+        at += ReadLength(in);
+        size_t literal = ReadLength(in + 2);
+        in += 4;
+
+        for (size_t j = 0; j < literal; ++j)
+        {
+            s[at++] ^= *in++;
+        }
+    }
+}
+
+void Rewind::DropOldest()
+{
+    size_t dropped = first;
+
+    first = (first + 1) % entryCapacity;
+    --count;
+
+    // deltas are useless without their keyframe
+    while (count && entries[first].keyframe == dropped)
+    {
+        first = (first + 1) % entryCapacity;
+        --count;
+    }
+
+    if (dropped == keyframeSlot)
+    {
+        sinceKeyframe = keyframeInterval;
+    }
+}
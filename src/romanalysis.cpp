@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "chip8.h"
+#include "romanalysis.h"
+
+// does the instruction skip the next one on some condition
+static bool Skips(Chip8::Handler handler)
+{
+    return handler == &Chip8::OP_3xkk
+        || handler == &Chip8::OP_4xkk
+        || handler == &Chip8::OP_5xy0
+        || handler == &Chip8::OP_9xy0
+        || handler == &Chip8::OP_Ex9E
+        || handler == &Chip8::OP_ExA1;
+}
+
+// does the instruction go somewhere other than the next instruction
+static bool Branches(Chip8::Handler handler)
+{
+    return Skips(handler)
+        || handler == &Chip8::OP_00EE
+        || handler == &Chip8::OP_00FD
+        || handler == &Chip8::OP_1nnn
+        || handler == &Chip8::OP_2nnn
+        || handler == &Chip8::OP_Bnnn;
+}
+
+void RomAnalysis::Analyze(uint8_t const* rom, size_t size)
+{
+    blocks.clear();
+    data.clear();
+    instructions = 0;
+    loops = 0;
+
+    size_t const maxSize = Chip8::MAX_ROM_SIZE;
+    unsigned int const start = Chip8::START_ADDRESS;
+    unsigned int const end = start + std::min(size, maxSize);
+
+    // a whole instruction has to be inside the ROM to be followed
+    auto inside = [start, end](unsigned int address)
+    {
+        return address >= start && address + 1 < end;
+    };
+
+    auto fetch = [rom, start](unsigned int address)
+    {
+        return static_cast<uint16_t>((rom[address - start] << 8u) | rom[address - start + 1]);
+    };
+
+    // the first byte of every instruction reached
+    std::vector<bool> reached(Memory::SIZE);
+    // every byte of every instruction reached
+    std::vector<bool> code(Memory::SIZE);
+    // the addresses that start a block
+    std::vector<bool> leader(Memory::SIZE);
+    // the blocks still to trace
+    std::vector<uint16_t> work;
+
+    auto enter = [&](unsigned int address)
+    {
+        if (inside(address))
+        {
+            leader[address] = true;
+
+            if (!reached[address])
+            {
+                work.push_back(address);
+            }
+        }
+    };
+
+    enter(start);
+
+    // trace every path through the code
+    // each one runs straight on until it branches, runs out of ROM
+    // or joins a path traced before
+    while (!work.empty())
+    {
+        unsigned int address = work.back();
+        work.pop_back();
+
+        while (inside(address))
+        {
+            if (reached[address])
+            {
+                // two paths meet here
+                leader[address] = true;
+                break;
+            }
+
+            reached[address] = true;
+            code[address] = code[address + 1] = true;
+            ++instructions;
+
+            uint16_t opcode = fetch(address);
+            Chip8::Handler handler = Chip8::Decode(opcode);
+            unsigned int next = address + 2;
+
+            if (handler == &Chip8::OP_1nnn)
+            {
+                enter(opcode & 0x0FFFu);
+            }
+            else if (handler == &Chip8::OP_2nnn)
+            {
+                // the subroutine, then wherever it returns to
+                enter(opcode & 0x0FFFu);
+                enter(next);
+            }
+            else if (Skips(handler))
+            {
+                enter(next);
+                enter(next + 2);
+            }
+
+            if (Branches(handler))
+            {
+                break;
+            }
+
+            address = next;
+        }
+    }
+
+    // cut the code into blocks at every leader
+    std::vector<int> blockIndex(Memory::SIZE, -1);
+
+    for (unsigned int address = start; address < end; ++address)
+    {
+        if (!leader[address] || !reached[address])
+        {
+            continue;
+        }
+
+        Block block{};
+        block.start = address;
+
+        unsigned int at = address;
+
+        while (true)
+        {
+            uint16_t opcode = fetch(at);
+            Chip8::Handler handler = Chip8::Decode(opcode);
+            unsigned int next = at + 2;
+
+            ++block.length;
+
+            auto follow = [&](unsigned int target)
+            {
+                if (inside(target) && leader[target])
+                {
+                    block.successors[block.successorCount++] = target;
+                }
+            };
+
+            if (handler == &Chip8::OP_1nnn)
+            {
+                follow(opcode & 0x0FFFu);
+                break;
+            }
+            else if (handler == &Chip8::OP_2nnn)
+            {
+                follow(opcode & 0x0FFFu);
+                follow(next);
+                break;
+            }
+            else if (Skips(handler))
+            {
+                follow(next);
+                follow(next + 2);
+                break;
+            }
+            else if (handler == &Chip8::OP_00EE || handler == &Chip8::OP_Bnnn)
+            {
+                block.indirect = true;
+                break;
+            }
+            else if (handler == &Chip8::OP_00FD)
+            {
+                break;
+            }
+
+            // run into the next block, or off the end of the ROM
+            if (!inside(next) || !reached[next] || leader[next])
+            {
+                follow(next);
+                break;
+            }
+
+            at = next;
+        }
+
+        blockIndex[address] = blocks.size();
+        blocks.push_back(block);
+    }
+
+    // find the loops with a depth first search from the entry point
+    // an edge back to a block that is still being searched closes a loop
+    if (!blocks.empty())
+    {
+        // 0: not visited yet, 1: on the search path, 2: done
+        std::vector<uint8_t> state(blocks.size());
+        // a block and how many of its successors were searched
+        std::vector<std::pair<int, unsigned int>> path;
+
+        path.emplace_back(blockIndex[start], 0);
+        state[blockIndex[start]] = 1;
+
+        while (!path.empty())
+        {
+            auto& top = path.back();
+            Block& block = blocks[top.first];
+
+            if (top.second == block.successorCount)
+            {
+                state[top.first] = 2;
+                path.pop_back();
+                continue;
+            }
+
+            int successor = blockIndex[block.successors[top.second++]];
+
+            if (state[successor] == 1)
+            {
+                loops += !blocks[successor].loop;
+                blocks[successor].loop = true;
+            }
+            else if (state[successor] == 0)
+            {
+                state[successor] = 1;
+                path.emplace_back(successor, 0);
+            }
+        }
+    }
+
+    // whatever part of the ROM no instruction covers is data
+    for (unsigned int address = start; address < end; ++address)
+    {
+        if (code[address])
+        {
+            continue;
+        }
+
+        if (!data.empty() && data.back().start + data.back().size == address)
+        {
+            ++data.back().size;
+        }
+        else
+        {
+            data.push_back(Region{ static_cast<uint16_t>(address), 1 });
+        }
+    }
+}
+
+RomAnalysis::Block const* RomAnalysis::BlockAt(uint16_t address) const
+{
+    auto found = std::lower_bound(blocks.begin(), blocks.end(), address,
+        [](Block const& block, uint16_t value) { return block.start < value; });
+
+    return found != blocks.end() && found->start == address ? &*found : nullptr;
+}
@@ -0,0 +1,46 @@
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "romcache.h"
+#include "romimage.h"
+
+std::shared_ptr<RomImage const> RomCache::Get(std::string const& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = images.find(path);
+
+        if (found != images.end())
+        {
+            return found->second;
+        }
+    }
+
+    // open the file without holding the lock, so that other threads can
+    // keep getting the images that are already cached
+    auto image = std::make_shared<RomImage const>(path.c_str());
+
+    if (!image->Loaded())
+    {
+        return nullptr;
+    }
+
+    // if another thread opened the same file in the meantime, use its image
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return images.emplace(path, image).first->second;
+}
+
+void RomCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    images.clear();
+}
+
+size_t RomCache::Size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return images.size();
+}
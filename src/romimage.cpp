@@ -0,0 +1,92 @@
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+#include "romimage.h"
+
+// romimage.h decides whether files are mapped
+#ifdef CHIP8_ROM_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+RomImage::RomImage(char const* filename)
+{
+#ifdef CHIP8_ROM_MMAP
+    int file = open(filename, O_RDONLY);
+
+    if (file < 0)
+    {
+        return;
+    }
+
+    struct stat info;
+
+    if (fstat(file, &info) == 0 && S_ISREG(info.st_mode))
+    {
+        size = info.st_size;
+
+        // an empty file can't be mapped, but it is still an empty ROM
+        if (size == 0)
+        {
+            loaded = true;
+        }
+        else
+        {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+
+            if (mapping != MAP_FAILED)
+            {
+                data = static_cast<uint8_t const*>(mapping);
+                loaded = true;
+            }
+        }
+    }
+
+    // the mapping stays valid after the file is closed
+    close(file);
+#else
+    // open a filestream of the ROM binary and move the pointer to the end
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+
+    if (file.is_open())
+    {
+        buffer.resize(file.tellg());
+
+        file.seekg(0, std::ios::beg);
+        file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+        data = buffer.empty() ? nullptr : buffer.data();
+        size = buffer.size();
+        loaded = true;
+    }
+#endif
+}
+
+RomImage::~RomImage()
+{
+#ifdef CHIP8_ROM_MMAP
+    if (data)
+    {
+        munmap(const_cast<uint8_t*>(data), size);
+    }
+#endif
+}
+
+bool RomImage::Loaded() const
+{
+    return loaded;
+}
+
+uint8_t const* RomImage::Data() const
+{
+    return data;
+}
+
+size_t RomImage::Size() const
+{
+    return size;
+}
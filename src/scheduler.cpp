@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "chip8.h"
+#include "scheduler.h"
+
+Scheduler::Scheduler(unsigned int instructionsPerFrame)
+    : instructionsPerFrame(instructionsPerFrame)
+    , execute([](Chip8& chip8, unsigned long count)
+        {
+            for (unsigned long i = 0; i < count; ++i)
+            {
+                chip8.Cycle();
+            }
+
+            return count;
+        })
+{
+}
+
+void Scheduler::SetRate(double instructionsPerSecond)
+{
+    double perFrame = std::max(instructionsPerSecond, 0.0) / FRAME_RATE;
+    double whole = std::floor(perFrame);
+
+    instructionsPerFrame = static_cast<unsigned int>(std::min(whole, 4294967295.0));
+    frameFraction = static_cast<uint32_t>(std::min((perFrame - whole) * 4294967296.0, 4294967295.0));
+    fractionCarry = 0;
+}
+
+unsigned long Scheduler::FrameLength() const
+{
+    // one more instruction whenever the carried fraction wraps around
+    return instructionsPerFrame + ((uint64_t(fractionCarry) + frameFraction) >> 32);
+}
+
+void Scheduler::RunFrame(Chip8& chip8)
+{
+    Run(chip8, FrameLength());
+    EndFrame(chip8);
+}
+
+void Scheduler::Run(Chip8& chip8, unsigned long count)
+{
+    unsigned long remaining = count;
+
+    while (remaining)
+    {
+        // nothing can end an idle loop before the timers tick
+        // or the keys change, so skip the rest of it
+        if (skipIdle && chip8.SkipIdle(remaining))
+        {
+            cycles += remaining;
+            idleCycles += remaining;
+            break;
+        }
+
+        // check again every so often, in case the machine went idle
+        unsigned long ran = execute(chip8, std::min<unsigned long>(remaining, idleCheckInterval));
+
+        if (ran == 0)
+        {
+            break;
+        }
+
+        cycles += ran;
+        remaining -= ran;
+    }
+}
+
+void Scheduler::EndFrame(Chip8& chip8)
+{
+    if (endOfFrame)
+    {
+        endOfFrame(chip8);
+    }
+
+    // the timers tick at the end of every frame
+    chip8.TickTimers();
+    ++frames;
+    fractionCarry += frameFraction;
+}
+
+unsigned int Scheduler::Advance(Chip8& chip8, double seconds)
+{
+    pending += seconds * FRAME_RATE;
+
+    unsigned int due = static_cast<unsigned int>(std::floor(pending));
+    pending -= due;
+
+    if (due > maxCatchUp)
+    {
+        droppedFrames += due - maxCatchUp;
+        due = maxCatchUp;
+    }
+
+    for (unsigned int i = 0; i < due; ++i)
+    {
+        RunFrame(chip8);
+    }
+
+    return due;
+}
+
+unsigned int Scheduler::RunUntil(Chip8& chip8, Clock::time_point deadline)
+{
+    unsigned int run = 0;
+
+    do
+    {
+        RunFrame(chip8);
+        ++run;
+    } while (Clock::now() < deadline);
+
+    return run;
+}
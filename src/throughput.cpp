@@ -0,0 +1,48 @@
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+#include "throughput.h"
+
+Throughput::Throughput(double interval)
+    : interval(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval)))
+    , start(Clock::now())
+    , last(start)
+{
+}
+
+bool Throughput::Sample(uint64_t cycles, uint64_t idleCycles)
+{
+    this->cycles = cycles;
+    this->idleCycles = idleCycles;
+
+    Clock::time_point now = Clock::now();
+
+    if (now - last < interval)
+    {
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(now - last).count();
+    uint64_t run = cycles - lastCycles;
+    uint64_t skipped = idleCycles - lastIdleCycles;
+
+    mips = run / seconds / 1e6;
+    executedMips = (run - skipped) / seconds / 1e6;
+
+    last = now;
+    lastCycles = cycles;
+    lastIdleCycles = idleCycles;
+
+    return true;
+}
+
+void Throughput::Report(std::ostream& out) const
+{
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    out << "instructions: " << cycles << " (" << cycles - idleCycles << " executed)"
+        << " in " << seconds << "s, "
+        << (seconds > 0 ? cycles / seconds / 1e6 : 0.0) << " MIPS ("
+        << (seconds > 0 ? (cycles - idleCycles) / seconds / 1e6 : 0.0) << " executed)\n";
+}
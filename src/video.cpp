@@ -0,0 +1,128 @@
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "constants.h"
+#include "video.h"
+
+// the colours of the four combinations of planes, in RGBA8888
+static uint32_t const palette[4] = { 0x00000000u, 0xFFFFFFFFu, 0xAAAAAAFFu, 0x555555FFu };
+
+// Expand one 64 pixel row of the first plane, with nothing in the second
+static void ExpandRow(uint64_t row, uint32_t* out)
+{
+#if defined(__SSE2__)
+    // each byte of the row is eight pixels
+    // broadcast it into every lane, isolate one bit per lane,
+    // and compare to turn set bits into all ones
+    __m128i const high = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    __m128i const low = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+
+    for (int byte = 7; byte >= 0; --byte, out += 8)
+    {
+        __m128i bits = _mm_set1_epi32((row >> (byte * 8)) & 0xFFu);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+            _mm_cmpeq_epi32(_mm_and_si128(bits, high), high));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4),
+            _mm_cmpeq_epi32(_mm_and_si128(bits, low), low));
+    }
+#else
+    // negating a bit gives all ones or all zeroes
+    // the compiler vectorizes this loop where it can
+    for (unsigned int col = 0; col < 64; ++col)
+    {
+        out[col] = -static_cast<uint32_t>((row >> (63 - col)) & 1u);
+    }
+#endif
+}
+
+// Expand one HIRES_WIDTH pixel line from both planes
+static void ExpandLine(uint64_t const* first, uint64_t const* second, uint32_t* out)
+{
+    // most programs only ever draw in the first plane
+    if (!(second[0] | second[1]))
+    {
+        ExpandRow(first[0], out);
+        ExpandRow(first[1], out + 64);
+
+        return;
+    }
+
+    for (unsigned int col = 0; col < HIRES_WIDTH; ++col)
+    {
+        unsigned int word = col / 64;
+        unsigned int shift = 63 - col % 64;
+
+        out[col] = palette[((first[word] >> shift) & 1u) | (((second[word] >> shift) & 1u) << 1)];
+    }
+}
+
+// Spread 32 bits over 64, each bit becoming two copies of itself
+static uint64_t Double(uint32_t bits)
+{
+    uint64_t x = bits;
+
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+
+    return x | (x << 1);
+}
+
+// Expand display row number row
+static void ExpandDisplayRow(PackedVideo const& video, bool hires, unsigned int row,
+    uint8_t* pixels, int pitch)
+{
+    if (hires)
+    {
+        ExpandLine(video[0][row], video[1][row], reinterpret_cast<uint32_t*>(pixels + row * pitch));
+
+        return;
+    }
+
+    // a low resolution row only uses the first word
+    // doubling its bits gives the pixels twice as wide,
+    // and copying the line gives them twice as tall
+    uint64_t first[VIDEO_ROW_WORDS] = { Double(video[0][row][0] >> 32), Double(video[0][row][0]) };
+    uint64_t second[VIDEO_ROW_WORDS] = { Double(video[1][row][0] >> 32), Double(video[1][row][0]) };
+    uint8_t* line = pixels + 2 * row * pitch;
+
+    ExpandLine(first, second, reinterpret_cast<uint32_t*>(line));
+    memcpy(line + pitch, line, HIRES_WIDTH * sizeof(uint32_t));
+}
+
+void ExpandVideo(PackedVideo const& video, bool hires, void* pixels, int pitch)
+{
+    unsigned int height = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+
+    for (unsigned int row = 0; row < height; ++row)
+    {
+        ExpandDisplayRow(video, hires, row, static_cast<uint8_t*>(pixels), pitch);
+    }
+}
+
+void ExpandVideo(PackedVideo const& video, bool hires, uint64_t rowMask,
+    void* pixels, int pitch)
+{
+    unsigned int height = hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+
+    for (unsigned int row = 0; row < height; ++row)
+    {
+        if (rowMask & (1ull << row))
+        {
+            ExpandDisplayRow(video, hires, row, static_cast<uint8_t*>(pixels), pitch);
+        }
+    }
+}
+
+uint64_t ExpandedRows(bool hires, uint64_t rowMask)
+{
+    // at low resolution display row n is output rows 2n and 2n + 1
+    return hires ? rowMask : Double(static_cast<uint32_t>(rowMask));
+}
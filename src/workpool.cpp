@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+
+#include "workpool.h"
+
+// the pool and the queue of the worker running on this thread, if any
+static thread_local WorkPool* currentPool;
+static thread_local size_t currentIndex;
+
+WorkPool::WorkPool(size_t count)
+{
+    count = std::max<size_t>(count, 1);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        queues.push_back(std::make_unique<Queue>());
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        workers.emplace_back(&WorkPool::Work, this, i);
+    }
+}
+
+WorkPool::~WorkPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+
+    wake.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+size_t WorkPool::Size() const
+{
+    return workers.size();
+}
+
+void WorkPool::Submit(Job job)
+{
+    size_t index = currentPool == this ? currentIndex : next++ % queues.size();
+    Queue& queue = *queues[index];
+
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+
+    queued.fetch_add(1);
+
+    // taking the lock orders this with a worker deciding to sleep,
+    // so it either sees the job or gets woken up
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+
+    wake.notify_one();
+}
+
+bool WorkPool::Take(size_t index, Job& job)
+{
+    // the oldest job of its own first
+    {
+        Queue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+
+        if (!own.jobs.empty())
+        {
+            job = std::move(own.jobs.front());
+            own.jobs.pop_front();
+            queued.fetch_sub(1);
+
+            return true;
+        }
+    }
+
+    // then the newest of somebody else's, which its owner would get to last
+    for (size_t i = 1; i < queues.size(); ++i)
+    {
+        Queue& other = *queues[(index + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(other.mutex);
+
+        if (!other.jobs.empty())
+        {
+            job = std::move(other.jobs.back());
+            other.jobs.pop_back();
+            queued.fetch_sub(1);
+            ++steals;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void WorkPool::Work(size_t index)
+{
+    currentPool = this;
+    currentIndex = index;
+
+    Job job;
+
+    while (true)
+    {
+        if (Take(index, job))
+        {
+            job();
+            job = nullptr;
+            ++jobs;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+
+        // only stop once the queues are empty
+        if (stopping && queued.load() == 0)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blockcache.h"
+#include "chip8.h"
+#include "chip8batch.h"
+#include "chip8pool.h"
+#include "jit.h"
+#include "profile.h"
+#include "romanalysis.h"
+#include "romcache.h"
+#include "scheduler.h"
+
+// Headless batch runner
+// runs every ROM in a list for a fixed number of cycles, spread over a pool
+// of worker threads, and prints the hash of each machine's final state
+// the output is one "<hash>  <rom>" line per ROM, in the order of the list
+
+// how the machines execute their instructions
+enum class Engine
+{
+    // Chip8::Cycle for every instruction
+    Interpreter,
+    // pre-decoded blocks from a BlockCache
+    Cache,
+    // native code from the Jit
+    Jit,
+    // the Jit checked against the interpreter after every block
+    Lockstep,
+    // copies of the machine stepped together as the lanes of a Chip8Batch
+    Batch
+};
+
+// the outcome of running a single ROM
+struct BatchResult
+{
+    bool loaded{};
+    uint64_t hash{};
+    // in lockstep mode, whether the Jit and the interpreter ever disagreed
+    // in batch mode, whether the lanes ended up different
+    bool diverged{};
+    // and if so, after how many instructions
+    unsigned long divergedAfter{};
+};
+
+// how every ROM in the batch is run
+struct BatchOptions
+{
+    // the number of instructions to run
+    unsigned long cycles{};
+    // the number of instructions between timer ticks
+    unsigned int instructionsPerFrame{ 10 };
+    Engine engine{ Engine::Interpreter };
+    // the number of lanes in batch mode
+    size_t lanes{ 8 };
+    // whether the scheduler skips the rest of a frame when the machine is idle
+    bool skipIdle{ true };
+    // whether the cache and the Jit translate the blocks a RomAnalysis
+    // finds before the ROM starts, instead of as it gets to them
+    bool prewarm{ true };
+    // whether the cache fuses common pairs of instructions
+    bool fuse{ true };
+    // where to write the profile of every ROM, nowhere if empty
+    // only builds with CHIP8_PROFILE record one, and the batch engine doesn't
+    std::string profileDirectory;
+};
+
+// every ROM is opened once no matter how often it appears in the list
+static RomCache romCache;
+
+// run one ROM on every lane of a Chip8Batch
+// the lanes all get the same input, so they should all end up the same
+static BatchResult RunLanes(std::string const& path, BatchOptions const& options)
+{
+    BatchResult result;
+
+    Chip8Batch batch(std::max<size_t>(options.lanes, 1));
+
+    for (size_t lane = 0; lane < batch.Lanes(); ++lane)
+    {
+        batch.Machine(lane).Seed(0);
+    }
+
+    std::shared_ptr<RomImage const> image = romCache.Get(path);
+    result.loaded = image && batch.LoadROM(image->Data(), image->Size());
+
+    if (!result.loaded)
+    {
+        return result;
+    }
+
+    unsigned int perFrame = options.instructionsPerFrame;
+    unsigned long frames = options.cycles / perFrame;
+
+    for (unsigned long frame = 0; frame < frames; ++frame)
+    {
+        batch.Run(perFrame);
+        batch.TickTimers();
+    }
+
+    batch.Run(options.cycles % perFrame);
+
+    result.hash = batch.Machine(0).Hash();
+
+    for (size_t lane = 1; lane < batch.Lanes(); ++lane)
+    {
+        result.diverged |= batch.Machine(lane).Hash() != result.hash;
+    }
+
+    return result;
+}
+
+#ifdef CHIP8_PROFILE
+// write the profile of the ROM at position number in the list
+// as <number>.json and <number>.folded in the profile directory
+static void WriteProfile(Profile const& profile, size_t number, BatchOptions const& options)
+{
+    std::string base = options.profileDirectory + "/" + std::to_string(number);
+    std::ofstream json(base + ".json");
+    std::ofstream folded(base + ".folded");
+
+    if (!json.is_open() || !folded.is_open())
+    {
+        std::cerr << "Could not write profile " << base << "\n";
+        return;
+    }
+
+    profile.WriteJson(json);
+    profile.WriteFolded(folded);
+}
+#endif
+
+// run one ROM to completion of its cycle budget
+// on the worker's own machine from the pool, which is reset first
+static BatchResult RunROM(Chip8Pool& pool, size_t slot, size_t number,
+    std::string const& path, BatchOptions const& options)
+{
+    if (options.engine == Engine::Batch)
+    {
+        return RunLanes(path, options);
+    }
+
+    BatchResult result;
+
+    Chip8& chip8 = pool.Reset(slot);
+    // use a fixed seed so that OP_Cxkk is reproducible between runs
+    chip8.Seed(0);
+
+#ifdef CHIP8_PROFILE
+    // it is big, so it lives on the heap
+    std::unique_ptr<Profile> profile;
+
+    if (!options.profileDirectory.empty())
+    {
+        profile = std::make_unique<Profile>();
+        chip8.profile = profile.get();
+    }
+#endif
+
+    std::shared_ptr<RomImage const> image = romCache.Get(path);
+    result.loaded = image && chip8.loadROM(image->Data(), image->Size());
+
+    if (!result.loaded)
+    {
+        return result;
+    }
+
+    // the budget is run as whole frames, plus whatever is left over
+    unsigned int perFrame = options.instructionsPerFrame;
+    unsigned long frames = options.cycles / perFrame;
+    unsigned long remainder = options.cycles % perFrame;
+
+    RomAnalysis analysis;
+
+    if (options.prewarm && options.engine != Engine::Interpreter)
+    {
+        analysis.Analyze(image->Data(), image->Size());
+    }
+
+    if (options.engine == Engine::Lockstep)
+    {
+        // both machines have to see the same timer ticks
+        Jit jit;
+        Chip8 reference = chip8;
+        jit.Prewarm(chip8, analysis);
+        unsigned long executed = 0;
+
+        for (unsigned long frame = 0; frame <= frames && !result.diverged; ++frame)
+        {
+            unsigned long count = frame < frames ? perFrame : remainder;
+            unsigned long agreed = jit.Lockstep(chip8, reference, count);
+
+            executed += agreed;
+            result.diverged = agreed != count;
+
+            // the leftover instructions don't make up a whole frame
+            if (frame < frames)
+            {
+                chip8.TickTimers();
+                reference.TickTimers();
+            }
+        }
+
+        result.divergedAfter = executed;
+    }
+    else
+    {
+        Scheduler scheduler(perFrame);
+        scheduler.skipIdle = options.skipIdle;
+        BlockCache cache;
+        cache.fuse = options.fuse;
+        Jit jit;
+
+        if (options.engine == Engine::Cache)
+        {
+            cache.Prewarm(chip8, analysis);
+            scheduler.execute = [&cache](Chip8& machine, unsigned long count)
+            {
+                return cache.Run(machine, count);
+            };
+        }
+        else if (options.engine == Engine::Jit)
+        {
+            jit.Prewarm(chip8, analysis);
+            scheduler.execute = [&jit](Chip8& machine, unsigned long count)
+            {
+                return jit.Run(machine, count);
+            };
+        }
+
+        for (unsigned long frame = 0; frame < frames; ++frame)
+        {
+            scheduler.RunFrame(chip8);
+        }
+
+        scheduler.execute(chip8, remainder);
+    }
+
+    result.hash = chip8.Hash();
+
+#ifdef CHIP8_PROFILE
+    if (profile)
+    {
+        chip8.profile = nullptr;
+        WriteProfile(*profile, number, options);
+    }
+#endif
+
+    return result;
+}
+
+static void Usage(char const* name)
+{
+    std::cerr << "Usage: " << name << " [--threads N] [--ipf N]"
+        << " [--engine interp|cache|jit|lockstep|batch] [--lanes N]"
+        << " [--no-idle-skip] [--no-prewarm] [--no-fuse] [--profile DIR] <ROM list> <Cycles>\n";
+    std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    BatchOptions options;
+    std::vector<char const*> positional;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            threadCount = std::stoul(argv[++i]);
+        }
+        else if (arg == "--ipf" && i + 1 < argc)
+        {
+            options.instructionsPerFrame = std::max(std::stoul(argv[++i]), 1ul);
+        }
+        else if (arg == "--engine" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+
+            if (name == "interp")
+            {
+                options.engine = Engine::Interpreter;
+            }
+            else if (name == "cache")
+            {
+                options.engine = Engine::Cache;
+            }
+            else if (name == "jit")
+            {
+                options.engine = Engine::Jit;
+            }
+            else if (name == "lockstep")
+            {
+                options.engine = Engine::Lockstep;
+            }
+            else if (name == "batch")
+            {
+                options.engine = Engine::Batch;
+            }
+            else
+            {
+                Usage(argv[0]);
+            }
+        }
+        else if (arg == "--lanes" && i + 1 < argc)
+        {
+            options.lanes = std::stoul(argv[++i]);
+        }
+        else if (arg == "--no-idle-skip")
+        {
+            options.skipIdle = false;
+        }
+        else if (arg == "--no-prewarm")
+        {
+            options.prewarm = false;
+        }
+        else if (arg == "--no-fuse")
+        {
+            options.fuse = false;
+        }
+        else if (arg == "--profile" && i + 1 < argc)
+        {
+#ifndef CHIP8_PROFILE
+            std::cerr << "--profile needs a build with PROFILE=1\n";
+            std::exit(EXIT_FAILURE);
+#endif
+            options.profileDirectory = argv[++i];
+        }
+        else
+        {
+            positional.push_back(argv[i]);
+        }
+    }
+
+    if (positional.size() != 2)
+    {
+        Usage(argv[0]);
+    }
+
+    char const* listFilename = positional[0];
+    options.cycles = std::stoul(positional[1]);
+
+    // hardware_concurrency is allowed to report 0 if it can't tell
+    threadCount = std::max(threadCount, 1u);
+
+    // read the ROM list, one path per line
+    std::ifstream list(listFilename);
+
+    if (!list.is_open())
+    {
+        std::cerr << "Could not open ROM list " << listFilename << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::string> roms;
+    std::string line;
+
+    while (std::getline(list, line))
+    {
+        if (!line.empty())
+        {
+            roms.push_back(line);
+        }
+    }
+
+    // each worker claims the next unclaimed ROM until the list runs out
+    // the machines share nothing, so no other synchronization is needed
+    std::vector<BatchResult> results(roms.size());
+    std::atomic<size_t> next{ 0 };
+
+    // every worker reuses one machine for all of its ROMs
+    // and the machines are packed together instead of one per stack
+    size_t workerCount = std::min<size_t>(threadCount, roms.size());
+    Chip8Pool pool(workerCount);
+
+    auto worker = [&](size_t slot)
+    {
+        for (size_t i = next++; i < roms.size(); i = next++)
+        {
+            results[i] = RunROM(pool, slot, i, roms[i], options);
+        }
+    };
+
+    std::vector<std::thread> workers;
+
+    for (size_t i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back(worker, i);
+    }
+
+    for (std::thread& thread : workers)
+    {
+        thread.join();
+    }
+
+    int failures = 0;
+
+    for (size_t i = 0; i < roms.size(); ++i)
+    {
+        if (results[i].diverged && options.engine == Engine::Batch)
+        {
+            std::cerr << "Lanes diverged in " << roms[i] << "\n";
+            ++failures;
+        }
+        else if (results[i].diverged)
+        {
+            std::cerr << "Jit diverged from the interpreter after "
+                << std::dec << results[i].divergedAfter << " cycles in " << roms[i] << "\n";
+            ++failures;
+        }
+        else if (results[i].loaded)
+        {
+            std::cout << std::hex << std::setw(16) << std::setfill('0')
+                << results[i].hash << "  " << roms[i] << "\n";
+        }
+        else
+        {
+            std::cerr << "Could not load ROM " << roms[i] << "\n";
+            ++failures;
+        }
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
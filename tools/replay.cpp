@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "chip8.h"
+#include "inputlog.h"
+#include "romimage.h"
+#include "scheduler.h"
+
+// Headless replay of a recorded session
+// runs a ROM with the seed, instructions per frame and key presses of an
+// input log recorded with bin/runner --record, as fast as it will go,
+// and prints a trace of the machine's hash after every frame
+// two replays of the same session print the same trace, so diffing the
+// traces of two builds shows the first frame where they differ
+// the output is one "<frame> <cycles> <hash>" line per frame
+
+static void Usage(char const* name)
+{
+    std::cerr << "Usage: " << name << " [--trace FILE] <ROM> <Input log>\n";
+    std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    char const* traceFilename = nullptr;
+    std::vector<char const*> positional;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--trace" && i + 1 < argc)
+        {
+            traceFilename = argv[++i];
+        }
+        else
+        {
+            positional.push_back(argv[i]);
+        }
+    }
+
+    if (positional.size() != 2)
+    {
+        Usage(argv[0]);
+    }
+
+    char const* romFilename = positional[0];
+    char const* logFilename = positional[1];
+
+    InputLog log;
+
+    if (!log.Load(logFilename))
+    {
+        std::cerr << "Could not read input log " << logFilename << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    RomImage image(romFilename);
+
+    if (!image.Loaded())
+    {
+        std::cerr << "Could not open ROM " << romFilename << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (InputLog::HashRom(image.Data(), image.Size()) != log.romHash)
+    {
+        std::cerr << logFilename << " was not recorded with " << romFilename << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    Chip8 chip8;
+    chip8.Seed(log.seed);
+
+    if (!chip8.loadROM(image.Data(), image.Size()))
+    {
+        std::cerr << "ROM " << romFilename << " is too big\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::ofstream traceFile;
+
+    if (traceFilename)
+    {
+        traceFile.open(traceFilename);
+
+        if (!traceFile.is_open())
+        {
+            std::cerr << "Could not write trace " << traceFilename << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    std::ostream& trace = traceFilename ? traceFile : std::cout;
+
+    // a session slower than one instruction a frame has empty frames,
+    // but one with no instructions at all would never end
+    Scheduler scheduler(log.frameFraction ? log.instructionsPerFrame : std::max(log.instructionsPerFrame, 1u));
+    scheduler.frameFraction = log.frameFraction;
+    size_t next = 0;
+
+    while (scheduler.cycles < log.cycles)
+    {
+        uint64_t frameEnd = scheduler.cycles + scheduler.FrameLength();
+        uint64_t end = std::min(frameEnd, log.cycles);
+
+        // every key press goes in at the cycle it was recorded at
+        while (next < log.events.size() && log.events[next].cycle < end)
+        {
+            InputLog::Event const& event = log.events[next++];
+
+            if (event.cycle > scheduler.cycles)
+            {
+                scheduler.Run(chip8, event.cycle - scheduler.cycles);
+            }
+
+            chip8.keypad[event.key] = event.pressed;
+        }
+
+        scheduler.Run(chip8, end - scheduler.cycles);
+
+        // a session that stopped part way through a frame doesn't tick the timers
+        if (end == frameEnd)
+        {
+            scheduler.EndFrame(chip8);
+        }
+
+        trace << std::dec << scheduler.frames << " " << scheduler.cycles << " "
+            << std::hex << std::setw(16) << std::setfill('0') << chip8.Hash()
+            << std::setfill(' ') << "\n";
+    }
+
+    return trace.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
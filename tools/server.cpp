@@ -0,0 +1,839 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "blockcache.h"
+#include "chip8.h"
+#include "framedelta.h"
+#include "jit.h"
+#include "romanalysis.h"
+#include "romcache.h"
+#include "scheduler.h"
+#include "workpool.h"
+
+// Session server
+// hosts a CHIP-8 session for every client that connects over TCP, all of
+// them run by a fixed pool of worker threads and served by a single epoll
+// loop, so there is no thread per session
+// the loop ticks every session at 60Hz. A tick runs one frame of the
+// session on the pool, in slices of at most --slice instructions, each of
+// them a job of its own that puts itself back at the end of the queue,
+// so a ROM running a lot of instructions a frame shares the workers with
+// everything else instead of holding one up. Idle workers steal slices
+// from busy ones. A session whose last frame hasn't finished by the next
+// tick skips it, which slows down that session and no other.
+// Linux only, since it is built on epoll, timerfd, eventfd and signalfd.
+//
+// Every message both ways is a type byte, a 16 bit payload length and
+// the payload, with numbers little endian:
+// from the client
+//   'S' start: 16 bit ROM number in the list, 64 bit seed
+//       must come first, and only once
+//   'K' key: a byte with the key in the low 4 bits and 0x10 if pressed
+// from the server
+//   'F' frame: 64 bit frame number and the changed rows, see framedelta.h
+//       only sent for frames that changed the display. The first one
+//       holds every row. A client that reads slowly gets fewer frames,
+//       each one covering all the rows changed since the last one sent.
+//   'E' error: a message, and then the connection is closed
+// SIGINT or SIGTERM stops the server and prints its statistics
+
+// how a session's instructions are executed
+enum class Engine
+{
+    Interpreter,
+    Cache,
+    Jit
+};
+
+struct ServerOptions
+{
+    uint16_t port{ 8088 };
+    size_t workers{ std::max(std::thread::hardware_concurrency(), 1u) };
+    // the rate every session runs at, as in Scheduler::SetRate
+    double instructionsPerSecond{ 600 };
+    // the most instructions a single job runs
+    unsigned long slice{ 1024 };
+    Engine engine{ Engine::Interpreter };
+};
+
+// the most output waiting for a client before frames stop being sent to it
+static const size_t MAX_BACKLOG = 64 * 1024;
+// the most input from a client that can be waiting for a whole message
+static const size_t MAX_INPUT = 4 * 1024;
+
+struct Session
+{
+    explicit Session(int socket)
+        : socket(socket)
+        , scheduler(0)
+    {
+    }
+
+    int const socket;
+
+    // the machine, only touched by the job running its frame
+    // jobs for a session never overlap, since a frame only starts once
+    // the last one is done
+    Chip8 chip8;
+    Scheduler scheduler;
+    // only made for sessions that use them
+    std::unique_ptr<BlockCache> cache;
+    std::unique_ptr<Jit> jit;
+    // the instructions left in the frame being run
+    unsigned long remaining{};
+
+    // whether a frame is being run, set by the loop and cleared by the job
+    std::atomic<bool> busy{};
+    // whether the client is gone, so jobs still queued should stop
+    std::atomic<bool> closed{};
+    // whether the client is too far behind to be sent another frame
+    std::atomic<bool> backlogged{};
+
+    // what the loop and the jobs hand each other
+    std::mutex mutex;
+    // keypad changes, in the same format as the 'K' message
+    std::vector<uint8_t> keys;
+    // messages for the loop to send
+    std::vector<uint8_t> outbox;
+
+    // the loop's own state
+    bool started{};
+    // whether the loop is waiting for the socket to take more output
+    bool writing{};
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> output;
+    // ticks skipped because the last frame wasn't done
+    unsigned long lateTicks{};
+};
+
+// the state shared by the loop and the jobs
+struct Server
+{
+    ServerOptions options;
+    std::vector<std::shared_ptr<RomImage const>> roms;
+    // sessions with something in their outbox, and the eventfd that
+    // wakes the loop up to send it
+    std::mutex readyMutex;
+    std::vector<std::shared_ptr<Session>> ready;
+    int wakeup{ -1 };
+
+    // statistics
+    std::atomic<unsigned long> frames{};
+    std::atomic<unsigned long> framesSent{};
+    std::atomic<unsigned long> bytesSent{};
+    unsigned long sessions{};
+    unsigned long lateTicks{};
+};
+
+static void PutInteger(std::vector<uint8_t>& out, uint64_t value, unsigned int bytes)
+{
+    for (unsigned int i = 0; i < bytes; ++i)
+    {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+static uint64_t GetInteger(uint8_t const* data, unsigned int bytes)
+{
+    uint64_t value = 0;
+
+    for (unsigned int i = 0; i < bytes; ++i)
+    {
+        value |= uint64_t(data[i]) << (8 * i);
+    }
+
+    return value;
+}
+
+// Queue the changed rows of the session's display for the loop to send
+// from the job that just finished a frame
+static void SendFrame(Server& server, std::shared_ptr<Session> const& session)
+{
+    Chip8& chip8 = session->chip8;
+
+    // rows a backlogged client misses stay dirty for the next frame
+    if (!chip8.dirtyRows || session->backlogged.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    bool wasEmpty;
+
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        std::vector<uint8_t>& out = session->outbox;
+        wasEmpty = out.empty();
+
+        size_t header = out.size();
+        out.push_back('F');
+        PutInteger(out, 0, 2);
+        PutInteger(out, session->scheduler.frames, 8);
+        EncodeFrameDelta(out, chip8.video, chip8.hires, chip8.dirtyRows);
+
+        size_t length = out.size() - header - 3;
+        out[header + 1] = static_cast<uint8_t>(length);
+        out[header + 2] = static_cast<uint8_t>(length >> 8);
+    }
+
+    chip8.dirtyRows = 0;
+    ++server.framesSent;
+
+    // the loop already knows about a session with anything in its outbox
+    if (wasEmpty)
+    {
+        {
+            std::lock_guard<std::mutex> lock(server.readyMutex);
+            server.ready.push_back(session);
+        }
+
+        uint64_t one = 1;
+        ssize_t written = write(server.wakeup, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+// Run the next slice of the session's frame, on a worker
+// and queue another job for the slice after it, if there is one
+static void RunSlice(WorkPool& pool, Server& server, std::shared_ptr<Session> session)
+{
+    if (session->closed.load(std::memory_order_relaxed))
+    {
+        session->busy.store(false, std::memory_order_release);
+        return;
+    }
+
+    Chip8& chip8 = session->chip8;
+    Scheduler& scheduler = session->scheduler;
+
+    // the keys pressed since the last slice
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+
+        for (uint8_t key : session->keys)
+        {
+            chip8.keypad[key & 0xF] = (key & 0x10) != 0;
+        }
+
+        session->keys.clear();
+    }
+
+    unsigned long count = std::min(session->remaining, server.options.slice);
+    uint64_t idleCycles = scheduler.idleCycles;
+
+    scheduler.Run(chip8, count);
+    session->remaining -= count;
+
+    // a machine that went idle stays that way until the timers tick, or a
+    // key changes, which only happens between slices anyway. Skipping the
+    // rest of the frame at once saves a job for every slice of it
+    if (scheduler.idleCycles != idleCycles && session->remaining)
+    {
+        scheduler.Run(chip8, session->remaining);
+        session->remaining = 0;
+    }
+
+    if (session->remaining)
+    {
+        pool.Submit([&pool, &server, session] { RunSlice(pool, server, session); });
+        return;
+    }
+
+    scheduler.EndFrame(chip8);
+    ++server.frames;
+    SendFrame(server, session);
+
+    // the loop can start the next frame now
+    session->busy.store(false, std::memory_order_release);
+}
+
+// Start the session with ROM number rom
+// returns an error message, or nullptr if it started
+static char const* Start(Server& server, Session& session, uint16_t rom, uint64_t seed)
+{
+    if (rom >= server.roms.size())
+    {
+        return "no such ROM";
+    }
+
+    RomImage const& image = *server.roms[rom];
+    Chip8& chip8 = session.chip8;
+
+    chip8.Seed(seed);
+
+    if (!chip8.loadROM(image.Data(), image.Size()))
+    {
+        return "ROM too big";
+    }
+
+    Scheduler& scheduler = session.scheduler;
+    scheduler.SetRate(server.options.instructionsPerSecond);
+
+    if (server.options.engine != Engine::Interpreter)
+    {
+        RomAnalysis analysis;
+        analysis.Analyze(image.Data(), image.Size());
+
+        if (server.options.engine == Engine::Cache)
+        {
+            BlockCache& cache = *(session.cache = std::make_unique<BlockCache>());
+            cache.Prewarm(chip8, analysis);
+            scheduler.execute = [&cache](Chip8& machine, unsigned long count)
+            {
+                return cache.Run(machine, count);
+            };
+        }
+        else
+        {
+            Jit& jit = *(session.jit = std::make_unique<Jit>());
+            jit.Prewarm(chip8, analysis);
+            scheduler.execute = [&jit](Chip8& machine, unsigned long count)
+            {
+                return jit.Run(machine, count);
+            };
+        }
+    }
+
+    session.started = true;
+
+    return nullptr;
+}
+
+// everything the loop itself keeps track of
+struct Loop
+{
+    Server& server;
+    WorkPool& pool;
+    int epoll;
+    std::unordered_map<int, std::shared_ptr<Session>> sessions;
+};
+
+static void Close(Loop& loop, std::shared_ptr<Session> const& session)
+{
+    // a frame in progress finds out at its next slice
+    session->closed.store(true, std::memory_order_relaxed);
+    loop.server.lateTicks += session->lateTicks;
+
+    epoll_ctl(loop.epoll, EPOLL_CTL_DEL, session->socket, nullptr);
+    close(session->socket);
+    loop.sessions.erase(session->socket);
+}
+
+// Send as much of the session's output as the socket takes
+// returns false if the client is gone
+static bool Flush(Loop& loop, Session& session)
+{
+    size_t sent = 0;
+
+    while (sent < session.output.size())
+    {
+        ssize_t written = send(session.socket, session.output.data() + sent,
+            session.output.size() - sent, MSG_NOSIGNAL);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+
+            return false;
+        }
+
+        sent += written;
+    }
+
+    loop.server.bytesSent += sent;
+    session.output.erase(session.output.begin(), session.output.begin() + sent);
+    session.backlogged.store(session.output.size() > MAX_BACKLOG, std::memory_order_relaxed);
+
+    // only ask to hear about the socket being writable while there is output
+    bool writing = !session.output.empty();
+
+    if (writing != session.writing)
+    {
+        epoll_event event{};
+        event.events = writing ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        event.data.fd = session.socket;
+        epoll_ctl(loop.epoll, EPOLL_CTL_MOD, session.socket, &event);
+        session.writing = writing;
+    }
+
+    return true;
+}
+
+// Send an error and close the connection
+static void Fail(Loop& loop, std::shared_ptr<Session> const& session, char const* message)
+{
+    size_t length = std::strlen(message);
+
+    session->output.push_back('E');
+    PutInteger(session->output, length, 2);
+    session->output.insert(session->output.end(), message, message + length);
+
+    // whatever doesn't fit in the socket's buffer is lost
+    Flush(loop, *session);
+    Close(loop, session);
+}
+
+// Handle every whole message the client sent
+// returns false, having closed the session, if one was bad
+static bool Receive(Loop& loop, std::shared_ptr<Session> const& session)
+{
+    std::vector<uint8_t>& input = session->input;
+    size_t used = 0;
+
+    while (input.size() - used >= 3)
+    {
+        uint8_t const* message = input.data() + used;
+        uint8_t type = message[0];
+        size_t length = GetInteger(message + 1, 2);
+
+        if (input.size() - used - 3 < length)
+        {
+            break;
+        }
+
+        uint8_t const* payload = message + 3;
+        used += 3 + length;
+
+        if (type == 'S' && length == 10 && !session->started)
+        {
+            char const* error = Start(loop.server, *session,
+                static_cast<uint16_t>(GetInteger(payload, 2)), GetInteger(payload + 2, 8));
+
+            if (error)
+            {
+                Fail(loop, session, error);
+                return false;
+            }
+        }
+        else if (type == 'K' && length == 1 && session->started)
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            session->keys.push_back(payload[0]);
+        }
+        else
+        {
+            Fail(loop, session, "bad message");
+            return false;
+        }
+    }
+
+    input.erase(input.begin(), input.begin() + used);
+
+    if (input.size() > MAX_INPUT)
+    {
+        Fail(loop, session, "message too long");
+        return false;
+    }
+
+    return true;
+}
+
+static void Accept(Loop& loop, int listener)
+{
+    while (true)
+    {
+        int socket = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (socket < 0)
+        {
+            // EAGAIN once every pending connection is accepted
+            return;
+        }
+
+        // frames are small and should go out as soon as they are ready
+        int on = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = socket;
+
+        if (epoll_ctl(loop.epoll, EPOLL_CTL_ADD, socket, &event) < 0)
+        {
+            close(socket);
+            continue;
+        }
+
+        loop.sessions[socket] = std::make_shared<Session>(socket);
+        ++loop.server.sessions;
+    }
+}
+
+// Read everything there is from a client
+static void Read(Loop& loop, std::shared_ptr<Session> const& session)
+{
+    uint8_t buffer[4096];
+
+    while (true)
+    {
+        ssize_t got = recv(session->socket, buffer, sizeof(buffer), 0);
+
+        if (got > 0)
+        {
+            session->input.insert(session->input.end(), buffer, buffer + got);
+
+            if (!Receive(loop, session))
+            {
+                return;
+            }
+
+            continue;
+        }
+
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return;
+        }
+
+        // the client hung up, or the connection broke
+        Close(loop, session);
+        return;
+    }
+}
+
+// Start the next frame of every session that is done with the last one
+static void Tick(Loop& loop)
+{
+    for (auto& entry : loop.sessions)
+    {
+        std::shared_ptr<Session> const& session = entry.second;
+
+        if (!session->started)
+        {
+            continue;
+        }
+
+        if (session->busy.load(std::memory_order_acquire))
+        {
+            ++session->lateTicks;
+            continue;
+        }
+
+        session->busy.store(true, std::memory_order_relaxed);
+        session->remaining = session->scheduler.FrameLength();
+
+        WorkPool& pool = loop.pool;
+        Server& server = loop.server;
+        std::shared_ptr<Session> job = session;
+        pool.Submit([&pool, &server, job] { RunSlice(pool, server, job); });
+    }
+}
+
+// Move the frames jobs finished into the output of their sessions, and send them
+static void Deliver(Loop& loop)
+{
+    uint64_t count;
+    ssize_t got = read(loop.server.wakeup, &count, sizeof(count));
+    (void)got;
+
+    std::vector<std::shared_ptr<Session>> ready;
+
+    {
+        std::lock_guard<std::mutex> lock(loop.server.readyMutex);
+        ready.swap(loop.server.ready);
+    }
+
+    for (std::shared_ptr<Session> const& session : ready)
+    {
+        if (session->closed.load(std::memory_order_relaxed))
+        {
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            session->output.insert(session->output.end(), session->outbox.begin(), session->outbox.end());
+            session->outbox.clear();
+        }
+
+        if (!Flush(loop, *session))
+        {
+            Close(loop, session);
+        }
+    }
+}
+
+static int Listen(uint16_t port)
+{
+    int listener = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (listener < 0)
+    {
+        return -1;
+    }
+
+    // take IPv4 connections too, and don't wait out TIME_WAIT on a restart
+    int off = 0, on = 1;
+    setsockopt(listener, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in6 address{};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(port);
+
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+        || listen(listener, SOMAXCONN) < 0)
+    {
+        close(listener);
+        return -1;
+    }
+
+    return listener;
+}
+
+static void Usage(char const* name)
+{
+    std::cerr << "Usage: " << name << " [--port N] [--workers N] [--ips N] [--slice N]"
+        << " [--engine interp|cache|jit] <ROM list>\n";
+    std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    Server server;
+    ServerOptions& options = server.options;
+    std::vector<char const*> positional;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--port" && i + 1 < argc)
+        {
+            options.port = static_cast<uint16_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--workers" && i + 1 < argc)
+        {
+            options.workers = std::max(std::stoul(argv[++i]), 1ul);
+        }
+        else if (arg == "--ips" && i + 1 < argc)
+        {
+            options.instructionsPerSecond = std::stod(argv[++i]);
+        }
+        else if (arg == "--slice" && i + 1 < argc)
+        {
+            options.slice = std::max(std::stoul(argv[++i]), 1ul);
+        }
+        else if (arg == "--engine" && i + 1 < argc)
+        {
+            std::string name = argv[++i];
+
+            if (name == "interp")
+            {
+                options.engine = Engine::Interpreter;
+            }
+            else if (name == "cache")
+            {
+                options.engine = Engine::Cache;
+            }
+            else if (name == "jit")
+            {
+                options.engine = Engine::Jit;
+            }
+            else
+            {
+                Usage(argv[0]);
+            }
+        }
+        else
+        {
+            positional.push_back(argv[i]);
+        }
+    }
+
+    if (positional.size() != 1)
+    {
+        Usage(argv[0]);
+    }
+
+    // every ROM is opened up front, so a bad list fails now
+    // rather than when a client asks for it
+    std::ifstream list(positional[0]);
+
+    if (!list.is_open())
+    {
+        std::cerr << "Could not open ROM list " << positional[0] << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    RomCache romCache;
+    std::string line;
+
+    while (std::getline(list, line))
+    {
+        if (line.empty())
+        {
+            continue;
+        }
+
+        std::shared_ptr<RomImage const> image = romCache.Get(line);
+
+        if (!image)
+        {
+            std::cerr << "Could not open ROM " << line << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+
+        server.roms.push_back(image);
+    }
+
+    // the signals are taken through a signalfd, so they have to be blocked
+    // before the workers start and inherit the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    int listener = Listen(options.port);
+
+    if (listener < 0)
+    {
+        std::cerr << "Could not listen on port " << options.port << ": " << std::strerror(errno) << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    server.wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int stop = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    itimerspec period{};
+    period.it_interval.tv_nsec = static_cast<long>(1e9 / Scheduler::FRAME_RATE);
+    period.it_value = period.it_interval;
+    timerfd_settime(timer, 0, &period, nullptr);
+
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    for (int fd : { listener, server.wakeup, stop, timer })
+    {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    std::cerr << "Serving " << server.roms.size() << " ROMs on port " << options.port
+        << " with " << options.workers << " workers\n";
+
+    {
+        WorkPool pool(options.workers);
+        Loop loop{ server, pool, epoll, {} };
+        bool running = true;
+        // the most ticks that were due at once
+        uint64_t missedTicks = 0;
+
+        while (running)
+        {
+            epoll_event events[64];
+            int count = epoll_wait(epoll, events, 64, -1);
+
+            for (int i = 0; i < count; ++i)
+            {
+                int fd = events[i].data.fd;
+
+                if (fd == listener)
+                {
+                    Accept(loop, listener);
+                }
+                else if (fd == timer)
+                {
+                    // ticks the loop was too busy for are dropped
+                    uint64_t due = 0;
+                    ssize_t got = read(timer, &due, sizeof(due));
+                    (void)got;
+                    missedTicks += due > 1 ? due - 1 : 0;
+                    Tick(loop);
+                }
+                else if (fd == server.wakeup)
+                {
+                    Deliver(loop);
+                }
+                else if (fd == stop)
+                {
+                    running = false;
+                }
+                else
+                {
+                    auto found = loop.sessions.find(fd);
+
+                    // closed by an earlier event of this batch
+                    if (found == loop.sessions.end())
+                    {
+                        continue;
+                    }
+
+                    std::shared_ptr<Session> session = found->second;
+
+                    if (events[i].events & EPOLLOUT && !Flush(loop, *session))
+                    {
+                        Close(loop, session);
+                        continue;
+                    }
+
+                    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    {
+                        Read(loop, session);
+                    }
+                }
+            }
+        }
+
+        while (!loop.sessions.empty())
+        {
+            Close(loop, loop.sessions.begin()->second);
+        }
+
+        std::cout << "sessions: " << server.sessions
+            << " frames: " << server.frames << " sent: " << server.framesSent
+            << " bytes: " << server.bytesSent
+            << " late: " << server.lateTicks << " missed ticks: " << missedTicks << "\n";
+        std::cout << "jobs: " << pool.jobs << " stolen: " << pool.steals << "\n";
+
+        // the pool finishes what is queued before it goes
+    }
+
+    close(epoll);
+    close(timer);
+    close(stop);
+    close(server.wakeup);
+    close(listener);
+
+    return EXIT_SUCCESS;
+}